@@ -0,0 +1,196 @@
+#include "BlockCache.h"
+
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+
+#include <cstring>
+
+static const char* TAG = "BlockCache";
+
+bool BlockCache::init(const StorageCacheConfig_t& config, uint32_t capacity, BlockCacheRead_t read, BlockCacheProgram_t program, void* ctx) {
+    if (config.blockCount == 0 || config.blockSize < 16 || (config.blockSize & (config.blockSize - 1))) {
+        ESP_LOGE(TAG, "Invalid cache geometry, block size must be a power of two");
+        return false;
+    }
+
+    this->config = config;
+    this->capacity = capacity;
+    backendRead = read;
+    backendProgram = program;
+    this->ctx = ctx;
+
+    blockShift = 0;
+    while ((1UL << blockShift) < config.blockSize) blockShift++;
+
+    uint32_t caps = config.usePsram ? MALLOC_CAP_SPIRAM : (MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    data = (uint8_t*)heap_caps_malloc(config.blockSize * config.blockCount, caps);
+    lines = (Line_t*)calloc(config.blockCount, sizeof(Line_t));
+
+    if (data == NULL || lines == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate %u bytes of cache", config.blockSize * config.blockCount);
+        done();
+        return false;
+    }
+
+    tick = 0;
+    hand = 0;
+    lastBlock = UINT32_MAX - 1;
+    resetStats();
+
+    ESP_LOGI(TAG, "Cache enabled, %u x %u bytes, policy: %s, read ahead: %u", config.blockCount, config.blockSize,
+             (config.policy == STORAGE_CACHE_POLICY_CLOCK) ? "CLOCK" : "LRU", config.readAhead);
+    return true;
+}
+
+void BlockCache::done() {
+    heap_caps_free(data);
+    free(lines);
+    data = NULL;
+    lines = NULL;
+}
+
+// Linear scan, the line count is small compared to the cost of a single SPI transaction
+int BlockCache::find(uint32_t block) {
+    for (uint32_t i = 0; i < config.blockCount; i++) {
+        if (lines[i].valid && lines[i].block == block) return i;
+    }
+    return -1;
+}
+
+int BlockCache::victim() {
+    for (uint32_t i = 0; i < config.blockCount; i++) {
+        if (!lines[i].valid) return i;
+    }
+
+    stats.evictions++;
+
+    if (config.policy == STORAGE_CACHE_POLICY_CLOCK) {
+        while (lines[hand].referenced) {
+            lines[hand].referenced = false;
+            hand = (hand + 1) % config.blockCount;
+        }
+        int line = hand;
+        hand = (hand + 1) % config.blockCount;
+        return line;
+    }
+
+    int oldest = 0;
+    for (uint32_t i = 1; i < config.blockCount; i++) {
+        if ((tick - lines[i].stamp) > (tick - lines[oldest].stamp)) oldest = i;
+    }
+    return oldest;
+}
+
+int BlockCache::fill(uint32_t block, esp_err_t* err) {
+    int line = victim();
+    lines[line].valid = false;
+
+    *err = backendRead(ctx, block << blockShift, data + (line << blockShift), config.blockSize);
+    if (*err != ESP_OK) return -1;
+
+    lines[line].block = block;
+    lines[line].valid = true;
+    lines[line].referenced = false;
+    lines[line].stamp = tick;
+    return line;
+}
+
+void BlockCache::touch(int line) {
+    lines[line].stamp = ++tick;
+    lines[line].referenced = true;
+}
+
+esp_err_t BlockCache::read(uint32_t address, void* dest, uint32_t len) {
+    uint8_t* out = (uint8_t*)dest;
+    esp_err_t err = ESP_OK;
+
+    while (len) {
+        uint32_t block = address >> blockShift;
+        uint32_t offset = address & (config.blockSize - 1);
+        uint32_t n = config.blockSize - offset;
+        if (n > len) n = len;
+
+        // Hits on prefetched lines keep the stream going, so the next block is already loaded when it is needed
+        bool sequential = (block == lastBlock + 1);
+        lastBlock = block;
+
+        int line = find(block);
+        if (line >= 0) {
+            stats.hits++;
+        } else {
+            stats.misses++;
+            line = fill(block, &err);
+            if (line < 0) return err;
+        }
+
+        touch(line);
+        memcpy(out, data + (line << blockShift) + offset, n);
+        out += n;
+        address += n;
+        len -= n;
+
+        // Prefetch after copying so the lines being loaded can never evict the one just read
+        for (uint32_t i = 1; sequential && i <= config.readAhead && i < config.blockCount; i++) {
+            uint32_t next = block + i;
+            if ((next << blockShift) >= capacity || find(next) >= 0) continue;
+            if (fill(next, &err) < 0) break;
+            stats.prefetches++;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t BlockCache::program(uint32_t address, const void* src, uint32_t len) {
+    // NOR programming can only clear bits, mirror that on the cached copy
+    const uint8_t* in = (const uint8_t*)src;
+    for (uint32_t pos = 0; pos < len;) {
+        uint32_t block = (address + pos) >> blockShift;
+        uint32_t offset = (address + pos) & (config.blockSize - 1);
+        uint32_t n = config.blockSize - offset;
+        if (n > len - pos) n = len - pos;
+
+        int line = find(block);
+        if (line >= 0) {
+            uint8_t* cached = data + (line << blockShift) + offset;
+            for (uint32_t i = 0; i < n; i++) cached[i] &= in[pos + i];
+        }
+        pos += n;
+    }
+
+    stats.programs++;
+    esp_err_t err = backendProgram(ctx, address, src, len);
+
+    // Cached lines already had the program applied, flash may hold anything now
+    if (err != ESP_OK) invalidate(address, len);
+    return err;
+}
+
+void BlockCache::erase(uint32_t address, uint32_t len) {
+    for (uint32_t i = 0; i < config.blockCount; i++) {
+        if (!lines[i].valid) continue;
+        uint32_t start = lines[i].block << blockShift;
+        uint32_t end = start + config.blockSize;
+        if (end <= address || start >= address + len) continue;
+
+        uint32_t from = (start > address) ? start : address;
+        uint32_t to = (end < address + len) ? end : address + len;
+        memset(data + (i << blockShift) + (from - start), 0xFF, to - from);
+    }
+}
+
+void BlockCache::invalidate(uint32_t address, uint32_t len) {
+    for (uint32_t i = 0; i < config.blockCount; i++) {
+        uint32_t start = lines[i].block << blockShift;
+        if (lines[i].valid && start < address + len && start + config.blockSize > address) {
+            lines[i].valid = false;
+        }
+    }
+}
+
+StorageCacheStats_t BlockCache::getStats() {
+    return stats;
+}
+
+void BlockCache::resetStats() {
+    memset(&stats, 0, sizeof(stats));
+}
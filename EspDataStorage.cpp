@@ -1,14 +1,22 @@
 #include "EspDataStorage.h"
 
 #include <esp_log.h>
+#include <esp_rom_crc.h>
 #include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
 #include <freertos/semphr.h>
+#include <freertos/task.h>
 
 #include <cstring>
 
 #include "SPIFlash.h"
 
 #define MAX_OPEN_FILE 10
+#define MAX_PATH_LEN 128
+#define ARCHIVE_CHUNK_SIZE 512
+#define ARCHIVE_CHUNK_COUNT 2
+#define ARCHIVE_TASK_STACK_SIZE (1024 * 6)
+#define ARCHIVE_TEMP_SUFFIX ".imp"
 
 #define TAKE_LOCK()                                                             \
     do {                                                                        \
@@ -26,12 +34,89 @@
         }                                                                       \
     } while (false)
 
+// Only for closing handles opened under the lock, those must not be left to destructors on a timeout
+#define TAKE_LOCK_BLOCKING() xSemaphoreTake(mutex, portMAX_DELAY)
+
 #define GIVE_LOCK() xSemaphoreGive(mutex)
 
 static SemaphoreHandle_t mutex = NULL;
 
 static const char* TAG = "EspDataStorage";
 
+// TAKE_LOCK() for the middle of an operation, the caller still has to clean up on failure
+static bool tryLock(uint32_t waitTimeout_ms) {
+    if (xSemaphoreTake(mutex, pdMS_TO_TICKS(waitTimeout_ms)) == pdTRUE) return true;
+    ESP_LOGE(TAG, "Failed to take mutex");
+    return false;
+}
+
+static bool readArchive(StorageSource_t source, void* arg, void* dest, size_t len) {
+    uint8_t* ptr = (uint8_t*)dest;
+    while (len) {
+        size_t n = source(ptr, len, arg);
+        if (n == 0 || n > len) return false;
+        ptr += n;
+        len -= n;
+    }
+    return true;
+}
+
+typedef struct {
+    uint8_t* data;
+    size_t len;
+    bool last;
+    bool ok;
+} ArchiveChunk_t;
+
+struct StorageArchiveStream {
+    EspDataStorage* storage;
+    Partition_t* fs;
+    const char* dirname;
+    time_t since;
+    time_t newest;
+    uint32_t count;
+
+    ArchiveChunk_t chunks[ARCHIVE_CHUNK_COUNT];
+    ArchiveChunk_t* current;
+    QueueHandle_t freeChunks;  // Chunks the reader may fill
+    QueueHandle_t fullChunks;  // Chunks waiting for the sink
+    volatile bool aborted;
+};
+
+// Chunk currently being packed, blocks while the sink still holds every other chunk
+static ArchiveChunk_t* archiveChunk(StorageArchiveStream_t* stream) {
+    if (stream->current == NULL) {
+        xQueueReceive(stream->freeChunks, &stream->current, portMAX_DELAY);
+        stream->current->len = 0;
+        stream->current->last = false;
+        stream->current->ok = false;
+    }
+    return stream->current;
+}
+
+// The stream must not be touched after submitting the last chunk, exportdir() may already have returned
+static void archiveSubmit(StorageArchiveStream_t* stream) {
+    ArchiveChunk_t* chunk = stream->current;
+    stream->current = NULL;
+    xQueueSend(stream->fullChunks, &chunk, portMAX_DELAY);
+}
+
+static bool archiveWrite(StorageArchiveStream_t* stream, const void* src, size_t len) {
+    const uint8_t* ptr = (const uint8_t*)src;
+    while (len && !stream->aborted) {
+        ArchiveChunk_t* chunk = archiveChunk(stream);
+        size_t n = ARCHIVE_CHUNK_SIZE - chunk->len;
+        if (n > len) n = len;
+
+        memcpy(chunk->data + chunk->len, ptr, n);
+        chunk->len += n;
+        ptr += n;
+        len -= n;
+        if (chunk->len == ARCHIVE_CHUNK_SIZE) archiveSubmit(stream);
+    }
+    return !stream->aborted;
+}
+
 bool EspDataStorage::init(uint32_t waitTimeout_ms) {
     _waitTimeout_ms = waitTimeout_ms;
 
@@ -80,6 +165,34 @@ bool EspDataStorage::mkdev(uint8_t id, StorageDeviceType_t type) {
     return false;
 }
 
+bool EspDataStorage::mkcache(uint8_t id, const StorageCacheConfig_t& config) {
+    assert(mutex != NULL && "EspDataStorage has not been initialized, call init() first.");
+
+    auto it = devices.find(id);
+    if (it == devices.end() || !it->second) {
+        ESP_LOGW(TAG, "Failed to enable cache, storage device [%u] not found", id);
+        return false;
+    }
+
+    TAKE_LOCK();
+    bool success = it->second->enableCache(config);
+    GIVE_LOCK();
+    return success;
+}
+
+bool EspDataStorage::cachestat(uint8_t id, StorageCacheStats_t* stats, bool reset) {
+    assert(mutex != NULL && "EspDataStorage has not been initialized, call init() first.");
+    assert(stats != NULL && "Cache stats is NULL, invalid argument.");
+
+    auto it = devices.find(id);
+    if (it == devices.end() || !it->second) return false;
+
+    TAKE_LOCK();
+    bool success = it->second->getCacheStats(stats, reset);
+    GIVE_LOCK();
+    return success;
+}
+
 bool EspDataStorage::mkpartition(uint8_t partitionID, const char* label, size_t size) {
     assert(mutex != NULL && "EspDataStorage has not been initialized, call init() first.");
 
@@ -387,4 +500,393 @@ bool EspDataStorage::write(Partition_t* fs, const char* path, const char* data)
     f.close();
     GIVE_LOCK();
     return true;
+}
+
+bool EspDataStorage::mv(Partition_t* fs, const char* from, const char* to) {
+    assert(mutex != NULL && "EspDataStorage has not been initialized, call init() first.");
+    assert(fs != NULL && "Partition object is NULL, invalid argument.");
+
+    TAKE_LOCK();
+    if (!fs->rename(from, to)) {
+        ESP_LOGE(TAG, "Error renaming file %s to %s", from, to);
+        GIVE_LOCK();
+        return false;
+    }
+
+    GIVE_LOCK();
+    return true;
+}
+
+StorageErr_t EspDataStorage::read(Partition_t* fs, const char* path, uint8_t* dest, size_t len, uint32_t pos, size_t* readLen) {
+    assert(mutex != NULL && "EspDataStorage has not been initialized, call init() first.");
+    assert(fs != NULL && "Partition object is NULL, invalid argument.");
+
+    TAKE_LOCK_E();
+    File f = fs->open(path);
+    if (!f) {
+        ESP_LOGE(TAG, "Failed to open file for reading: %s", path);
+        f.close();
+        GIVE_LOCK();
+        return STORAGE_FAIL;
+    }
+
+    if (f.isDirectory()) {
+        ESP_LOGE(TAG, "Failed to read, path is directory: %s", path);
+        f.close();
+        GIVE_LOCK();
+        return STORAGE_READ_IS_DIRECTORY;
+    }
+
+    if (pos > f.size() || !f.seek(pos)) {
+        ESP_LOGE(TAG, "File position (%d) out of range: %s", pos, path);
+        f.close();
+        GIVE_LOCK();
+        return STORAGE_READ_OUT_OF_RANGE;
+    }
+
+    size_t n = f.read(dest, len);
+    f.close();
+    GIVE_LOCK();
+
+    if (readLen) *readLen = n;
+    return STORAGE_OK;
+}
+
+bool EspDataStorage::append(Partition_t* fs, const char* path, const uint8_t* data, size_t len) {
+    assert(mutex != NULL && "EspDataStorage has not been initialized, call init() first.");
+    assert(fs != NULL && "Partition object is NULL, invalid argument.");
+
+    TAKE_LOCK();
+    File f = fs->open(path, FILE_APPEND);
+    if (!f) {
+        ESP_LOGE(TAG, "Failed to open file for append");
+        f.close();
+        GIVE_LOCK();
+        return false;
+    }
+
+    if (f.write(data, len) != len) {
+        ESP_LOGE(TAG, "Append failed to file: %s", path);
+        f.close();
+        GIVE_LOCK();
+        return false;
+    }
+
+    f.close();
+    GIVE_LOCK();
+    return true;
+}
+
+bool EspDataStorage::write(Partition_t* fs, const char* path, const uint8_t* data, size_t len) {
+    assert(mutex != NULL && "EspDataStorage has not been initialized, call init() first.");
+    assert(fs != NULL && "Partition object is NULL, invalid argument.");
+
+    TAKE_LOCK();
+    File f = fs->open(path, FILE_WRITE);
+    if (!f) {
+        ESP_LOGE(TAG, "Failed to open file for write");
+        f.close();
+        GIVE_LOCK();
+        return false;
+    }
+
+    if (f.write(data, len) != len) {
+        ESP_LOGE(TAG, "Write failed to file: %s", path);
+        f.close();
+        GIVE_LOCK();
+        return false;
+    }
+
+    f.close();
+    GIVE_LOCK();
+    return true;
+}
+
+bool EspDataStorage::exportFile(Partition_t* fs, const char* path, StorageArchiveStream_t* stream) {
+    TAKE_LOCK();
+    File f = fs->open(path);
+    if (!f) {
+        ESP_LOGE(TAG, "Failed to open file for export: %s", path);
+        f.close();
+        GIVE_LOCK();
+        return false;
+    }
+
+    // Files without a modification time (CONFIG_LITTLEFS_USE_MTIME disabled) are always exported
+    time_t mtime = f.getLastWrite();
+    if (stream->since && mtime && mtime < stream->since) {
+        f.close();
+        GIVE_LOCK();
+        return true;
+    }
+
+    StorageArchiveEntry_t entry = {
+        .pathLen = (uint16_t)strlen(path),
+        .size = (uint32_t)f.size(),
+        .mtime = (int64_t)mtime,
+    };
+    GIVE_LOCK();
+
+    if (mtime > stream->newest) stream->newest = mtime;
+
+    bool res = archiveWrite(stream, &entry, sizeof(entry)) && archiveWrite(stream, path, entry.pathLen);
+
+    // Read straight into the chunk being packed, the sink drains the previous one meanwhile
+    uint32_t crc = 0;
+    uint32_t remaining = entry.size;
+    while (res && remaining) {
+        if (stream->aborted) {
+            res = false;
+            break;
+        }
+
+        ArchiveChunk_t* chunk = archiveChunk(stream);
+        size_t len = ARCHIVE_CHUNK_SIZE - chunk->len;
+        if (len > remaining) len = remaining;
+
+        if (!tryLock(_waitTimeout_ms)) {
+            res = false;
+            break;
+        }
+        len = f.read(chunk->data + chunk->len, len);
+        GIVE_LOCK();
+
+        if (len == 0) {
+            ESP_LOGE(TAG, "File changed during export: %s", path);
+            res = false;
+            break;
+        }
+
+        crc = esp_rom_crc32_le(crc, chunk->data + chunk->len, len);
+        chunk->len += len;
+        if (chunk->len == ARCHIVE_CHUNK_SIZE) archiveSubmit(stream);
+        remaining -= len;
+    }
+
+    TAKE_LOCK_BLOCKING();
+    f.close();
+    GIVE_LOCK();
+
+    if (!res) return false;
+    stream->count++;
+    return archiveWrite(stream, &crc, sizeof(crc));
+}
+
+bool EspDataStorage::exportTree(Partition_t* fs, const char* dirname, StorageArchiveStream_t* stream) {
+    TAKE_LOCK();
+    File root = fs->open(dirname);
+    if (!root || !root.isDirectory()) {
+        ESP_LOGW(TAG, "Failed to open directory for export: %s", dirname);
+        root.close();
+        GIVE_LOCK();
+        return false;
+    }
+
+    bool res = true;
+    bool locked = true;
+    File f = root.openNextFile();
+    while (f && res) {
+        char path[MAX_PATH_LEN] = {0};
+        bool isDirectory = f.isDirectory();
+        if (strlen(f.path()) >= sizeof(path)) {
+            ESP_LOGE(TAG, "Path too long for export: %s", f.path());
+            res = false;
+            break;
+        }
+        strcpy(path, f.path());
+        f.close();
+        GIVE_LOCK();
+        locked = false;
+
+        if (isDirectory) {
+            res = exportTree(fs, path, stream);
+        } else {
+            res = exportFile(fs, path, stream);
+        }
+
+        if (res) res = locked = tryLock(_waitTimeout_ms);
+        if (res) f = root.openNextFile();
+    }
+
+    if (!locked) TAKE_LOCK_BLOCKING();
+    root.close();
+    f.close();
+    GIVE_LOCK();
+    return res;
+}
+
+void EspDataStorage::exportTask(void* arg) {
+    StorageArchiveStream_t* stream = (StorageArchiveStream_t*)arg;
+
+    StorageArchiveHeader_t header = {
+        .magic = STORAGE_ARCHIVE_MAGIC,
+        .version = STORAGE_ARCHIVE_VERSION,
+        .flags = (uint16_t)(stream->since ? STORAGE_ARCHIVE_FLAG_INCREMENTAL : 0),
+        .since = (int64_t)stream->since,
+    };
+
+    bool res = archiveWrite(stream, &header, sizeof(header));
+    if (res) res = stream->storage->exportTree(stream->fs, stream->dirname, stream);
+    if (res) {
+        StorageArchiveEntry_t end = {.pathLen = 0, .size = stream->count, .mtime = 0};
+        res = archiveWrite(stream, &end, sizeof(end));
+    }
+
+    // The stream belongs to exportdir() again as soon as the last chunk is queued
+    ArchiveChunk_t* chunk = archiveChunk(stream);
+    chunk->last = true;
+    chunk->ok = res;
+    archiveSubmit(stream);
+    vTaskDelete(NULL);
+}
+
+bool EspDataStorage::exportdir(Partition_t* fs, const char* dirname, StorageSink_t sink, void* arg, time_t since, time_t* marker) {
+    assert(mutex != NULL && "EspDataStorage has not been initialized, call init() first.");
+    assert(fs != NULL && "Partition object is NULL, invalid argument.");
+    assert(sink != NULL && "Archive sink is NULL, invalid argument.");
+
+    StorageArchiveStream_t stream = {};
+    stream.storage = this;
+    stream.fs = fs;
+    stream.dirname = dirname;
+    stream.since = since;
+    stream.newest = since;
+
+    uint8_t* buffer = (uint8_t*)malloc(ARCHIVE_CHUNK_SIZE * ARCHIVE_CHUNK_COUNT);
+    stream.freeChunks = xQueueCreate(ARCHIVE_CHUNK_COUNT, sizeof(ArchiveChunk_t*));
+    stream.fullChunks = xQueueCreate(ARCHIVE_CHUNK_COUNT, sizeof(ArchiveChunk_t*));
+
+    bool res = (buffer != NULL && stream.freeChunks != NULL && stream.fullChunks != NULL);
+    if (!res) ESP_LOGE(TAG, "Failed to allocate export buffer");
+
+    for (uint8_t i = 0; res && i < ARCHIVE_CHUNK_COUNT; i++) {
+        ArchiveChunk_t* chunk = &stream.chunks[i];
+        chunk->data = buffer + (i * ARCHIVE_CHUNK_SIZE);
+        xQueueSend(stream.freeChunks, &chunk, 0);
+    }
+
+    // Flash is read on a helper task so the next chunk is filled while the sink sends the previous one
+    if (res && xTaskCreate(exportTask, "storage export", ARCHIVE_TASK_STACK_SIZE, &stream, uxTaskPriorityGet(NULL), NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create export task");
+        res = false;
+    }
+
+    while (res) {
+        ArchiveChunk_t* chunk = NULL;
+        xQueueReceive(stream.fullChunks, &chunk, portMAX_DELAY);
+
+        // Once the sink fails the remaining chunks are only recycled until the reader notices
+        if (chunk->len && !stream.aborted && !sink(chunk->data, chunk->len, arg)) stream.aborted = true;
+        if (chunk->last) {
+            res = chunk->ok && !stream.aborted;
+            break;
+        }
+        xQueueSend(stream.freeChunks, &chunk, portMAX_DELAY);
+    }
+
+    if (stream.freeChunks) vQueueDelete(stream.freeChunks);
+    if (stream.fullChunks) vQueueDelete(stream.fullChunks);
+    free(buffer);
+
+    if (!res) {
+        ESP_LOGE(TAG, "Failed to export directory: %s", dirname);
+        return false;
+    }
+
+    if (marker) *marker = stream.newest;
+    ESP_LOGD(TAG, "Exported %u file(s) from %s", stream.count, dirname);
+    return true;
+}
+
+bool EspDataStorage::importFile(Partition_t* fs, const char* path, uint32_t size, StorageSource_t source, void* arg, uint8_t* chunk) {
+    // Import next to the destination and only replace it once the checksum matched
+    char temp[MAX_PATH_LEN + sizeof(ARCHIVE_TEMP_SUFFIX)] = {0};
+    snprintf(temp, sizeof(temp), "%s" ARCHIVE_TEMP_SUFFIX, path);
+
+    TAKE_LOCK();
+    File f = fs->open(temp, FILE_WRITE, true);
+    GIVE_LOCK();
+    if (!f) {
+        ESP_LOGE(TAG, "Failed to create file for import: %s", temp);
+        return false;
+    }
+
+    bool res = true;
+    uint32_t crc = 0;
+    uint32_t remaining = size;
+    while (remaining && res) {
+        size_t len = (remaining < ARCHIVE_CHUNK_SIZE) ? remaining : ARCHIVE_CHUNK_SIZE;
+        res = readArchive(source, arg, chunk, len);
+        if (!res) break;
+
+        crc = esp_rom_crc32_le(crc, chunk, len);
+        if (!tryLock(_waitTimeout_ms)) {
+            res = false;
+            break;
+        }
+        res = (f.write(chunk, len) == len);
+        GIVE_LOCK();
+        remaining -= len;
+    }
+
+    uint32_t expected = 0;
+    if (res) res = readArchive(source, arg, &expected, sizeof(expected)) && (expected == crc);
+
+    // The temporary file is removed even when the lock timed out above
+    TAKE_LOCK_BLOCKING();
+    f.close();
+    if (res) res = fs->rename(temp, path);
+    if (!res) fs->remove(temp);
+    GIVE_LOCK();
+
+    if (!res) ESP_LOGE(TAG, "Failed to import file: %s", path);
+    return res;
+}
+
+bool EspDataStorage::importdir(Partition_t* fs, StorageSource_t source, void* arg) {
+    assert(mutex != NULL && "EspDataStorage has not been initialized, call init() first.");
+    assert(fs != NULL && "Partition object is NULL, invalid argument.");
+    assert(source != NULL && "Archive source is NULL, invalid argument.");
+
+    StorageArchiveHeader_t header;
+    if (!readArchive(source, arg, &header, sizeof(header)) ||
+        header.magic != STORAGE_ARCHIVE_MAGIC || header.version != STORAGE_ARCHIVE_VERSION) {
+        ESP_LOGE(TAG, "Invalid archive header");
+        return false;
+    }
+
+    uint8_t* chunk = (uint8_t*)malloc(ARCHIVE_CHUNK_SIZE);
+    if (chunk == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate import buffer");
+        return false;
+    }
+
+    bool res = false;
+    uint32_t count = 0;
+    while (true) {
+        StorageArchiveEntry_t entry;
+        if (!readArchive(source, arg, &entry, sizeof(entry))) {
+            ESP_LOGE(TAG, "Archive truncated after %u file(s)", count);
+            break;
+        }
+
+        if (entry.pathLen == 0) {
+            res = (entry.size == count);
+            if (!res) ESP_LOGE(TAG, "Archive file count mismatch, expected %u got %u", entry.size, count);
+            break;
+        }
+
+        char path[MAX_PATH_LEN] = {0};
+        if (entry.pathLen >= sizeof(path) || !readArchive(source, arg, path, entry.pathLen)) {
+            ESP_LOGE(TAG, "Invalid archive entry path");
+            break;
+        }
+
+        if (!importFile(fs, path, entry.size, source, arg, chunk)) break;
+        count++;
+    }
+
+    free(chunk);
+    if (res) ESP_LOGD(TAG, "Imported %u file(s)", count);
+    return res;
 }
\ No newline at end of file
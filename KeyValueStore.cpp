@@ -0,0 +1,846 @@
+#include "KeyValueStore.h"
+
+#include <esp_log.h>
+#include <esp_rom_crc.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#define KV_CHECKPOINT_MAGIC 0x5849564B  // "KVIX"
+#define KV_CHECKPOINT_VERSION 2
+#define KV_CHECKPOINT_FLAG_COMPACTING (1 << 0)
+#define KV_RECORD_TOMBSTONE (1 << 0)
+#define KV_LOC_NEXT (1UL << 31)
+#define KV_MIN_CAPACITY 8
+#define KV_MAX_COMPACT_BATCH 32
+#define KV_SCRATCH_SIZE 2048
+#define KV_RETRY_MIN_MS 10
+#define KV_RETRY_MAX_MS 2000
+#define KV_LOG_NAME_LEN 12  // "%08x.log"
+
+typedef struct __attribute__((packed)) {
+    uint32_t crc;  // Over everything after this field, key and value included
+    uint8_t keyLen;
+    uint8_t flags;
+    uint16_t valueLen;
+} KeyValueRecord_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t flags;
+    uint32_t gen;
+    uint32_t logSize;
+    uint32_t nextSize;  // Only set with KV_CHECKPOINT_FLAG_COMPACTING
+    uint32_t capacity;
+    uint32_t count;
+} KeyValueCheckpoint_t;
+
+static const char* TAG = "KeyValueStore";
+
+static uint64_t hashKey(const char* key, size_t len) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (uint8_t)key[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static uint32_t recordCrc(const uint8_t* record, size_t size) {
+    return esp_rom_crc32_le(0, record + sizeof(uint32_t), size - sizeof(uint32_t));
+}
+
+static bool validKey(const char* key, size_t* keyLen) {
+    if (key == NULL) return false;
+    *keyLen = strlen(key);
+    return *keyLen > 0 && *keyLen <= KV_MAX_KEY_LEN;
+}
+
+void KeyValueStore::logPath(uint32_t generation, char* dest) {
+    snprintf(dest, KV_MAX_PATH_LEN, "%s/%08x.log", dirname, generation);
+}
+
+void KeyValueStore::indexPath(char* dest, bool temp) {
+    snprintf(dest, KV_MAX_PATH_LEN, "%s/index%s", dirname, temp ? ".tmp" : "");
+}
+
+// Appends always go to the end of the file, reads seek anywhere
+bool KeyValueStore::openLog(uint32_t generation, File* file) {
+    char path[KV_MAX_PATH_LEN];
+    logPath(generation, path);
+    *file = fs->open(path, "a+", true);
+    if (!*file) {
+        ESP_LOGE(TAG, "Failed to open log: %s", path);
+        return false;
+    }
+    return true;
+}
+
+// After a failed append the handle may still buffer part of the data, so it is
+// reopened and the size on disk is taken as the end of the log from now on
+bool KeyValueStore::reopenLog(bool next) {
+    File& file = next ? nextFile : logFile;
+    uint32_t* end = next ? &nextSize : &logSize;
+
+    file.close();
+    if (!openLog(next ? gen + 1 : gen, &file)) return false;
+
+    uint32_t size = file.size();
+    if (size != *end) {
+        ESP_LOGW(TAG, "Log %s ends at %u instead of %u", file.path(), size, *end);
+        *end = size;
+        unsafeTail = true;
+    }
+    return true;
+}
+
+bool KeyValueStore::readLog(File& file, uint32_t pos, uint8_t* dest, size_t len) {
+    return file && file.seek(pos) && file.read(dest, len) == len;
+}
+
+bool KeyValueStore::appendLog(bool next, const uint8_t* data, size_t len) {
+    File& file = next ? nextFile : logFile;
+    uint32_t* end = next ? &nextSize : &logSize;
+
+    if (!file && !reopenLog(next)) return false;
+    if (unsafeTail) return false;
+
+    if (file.seek(0, SeekEnd) && file.write(data, len) == len) {
+        file.flush();
+        if (file.size() == *end + len) {
+            *end += len;
+            return true;
+        }
+    }
+
+    reopenLog(next);
+    return false;
+}
+
+// Only used without a usable checkpoint. With both G and G+1 on disk a compaction
+// of G was interrupted, so G is still the base generation.
+bool KeyValueStore::scanGenerations(uint32_t* generation) {
+    File root = fs->open(dirname);
+    if (!root || !root.isDirectory()) return false;
+
+    bool found = false;
+    uint32_t newest = 0;
+    for (File f = root.openNextFile(); f; f = root.openNextFile()) {
+        const char* name = strrchr(f.path(), '/');
+        name = name ? name + 1 : f.path();
+        if (strlen(name) != KV_LOG_NAME_LEN || strcmp(name + 8, ".log") != 0) continue;
+
+        char* last = NULL;
+        uint32_t generation = strtoul(name, &last, 16);
+        if (last != name + 8) continue;
+        if (!found || generation > newest) newest = generation;
+        found = true;
+    }
+    root.close();
+    if (!found) return false;
+
+    char path[KV_MAX_PATH_LEN];
+    if (newest > 0) {
+        logPath(newest - 1, path);
+        if (storage->exists(fs, path)) newest--;
+    }
+    *generation = newest;
+    return true;
+}
+
+int KeyValueStore::find(uint32_t hash, uint16_t tag) {
+    uint32_t mask = capacity - 1;
+    for (uint32_t i = hash & mask, n = 0; n < capacity; i = (i + 1) & mask, n++) {
+        if (slots[i].size == 0) return -1;
+        if (slots[i].hash == hash && slots[i].tag == tag) return i;
+    }
+    return -1;
+}
+
+bool KeyValueStore::insert(const Slot_t& slot) {
+    int index = find(slot.hash, slot.tag);
+    if (index >= 0) {
+        Slot_t& old = slots[index];
+        liveBytes -= old.size;
+        if (compacting && !(old.loc & KV_LOC_NEXT)) pendingMoves--;
+        old = slot;
+        liveBytes += slot.size;
+        return true;
+    }
+
+    if ((count + 1) * 4 > capacity * 3 && !grow()) return false;
+
+    uint32_t mask = capacity - 1;
+    uint32_t i = slot.hash & mask;
+    while (slots[i].size) i = (i + 1) & mask;
+    slots[i] = slot;
+    count++;
+    liveBytes += slot.size;
+    return true;
+}
+
+// Backward shift deletion, keeps probe sequences intact without tombstones
+void KeyValueStore::erase(int index) {
+    liveBytes -= slots[index].size;
+    if (compacting && !(slots[index].loc & KV_LOC_NEXT)) pendingMoves--;
+    count--;
+
+    uint32_t mask = capacity - 1;
+    uint32_t hole = index;
+    for (uint32_t j = (hole + 1) & mask; slots[j].size; j = (j + 1) & mask) {
+        uint32_t home = slots[j].hash & mask;
+        if (((j - home) & mask) >= ((j - hole) & mask)) {
+            slots[hole] = slots[j];
+            hole = j;
+        }
+    }
+    slots[hole].size = 0;
+}
+
+bool KeyValueStore::grow() {
+    uint32_t newCapacity = capacity * 2;
+    Slot_t* newSlots = (Slot_t*)calloc(newCapacity, sizeof(Slot_t));
+    if (newSlots == NULL) {
+        ESP_LOGE(TAG, "Failed to grow index to %u slots", newCapacity);
+        return false;
+    }
+
+    uint32_t mask = newCapacity - 1;
+    for (uint32_t i = 0; i < capacity; i++) {
+        if (slots[i].size == 0) continue;
+        uint32_t j = slots[i].hash & mask;
+        while (newSlots[j].size) j = (j + 1) & mask;
+        newSlots[j] = slots[i];
+    }
+
+    free(slots);
+    slots = newSlots;
+    capacity = newCapacity;
+    cursor = 0;
+    return true;
+}
+
+bool KeyValueStore::apply(const uint8_t* record, uint32_t loc) {
+    const KeyValueRecord_t* header = (const KeyValueRecord_t*)record;
+    uint64_t hash = hashKey((const char*)record + sizeof(KeyValueRecord_t), header->keyLen);
+    updates++;
+
+    if (header->flags & KV_RECORD_TOMBSTONE) {
+        int index = find((uint32_t)hash, (uint16_t)(hash >> 32));
+        if (index >= 0) erase(index);
+        return true;
+    }
+
+    Slot_t slot = {
+        .hash = (uint32_t)hash,
+        .tag = (uint16_t)(hash >> 32),
+        .size = (uint16_t)(sizeof(KeyValueRecord_t) + header->keyLen + header->valueLen),
+        .loc = loc,
+    };
+    return insert(slot);
+}
+
+bool KeyValueStore::replay(File& file, uint32_t from, bool next, bool* clean) {
+    uint32_t fileSize = file.size();
+    uint32_t off = from;
+    while (off + sizeof(KeyValueRecord_t) <= fileSize) {
+        const KeyValueRecord_t* header = (const KeyValueRecord_t*)scratch;
+        if (!readLog(file, off, scratch, sizeof(KeyValueRecord_t))) break;
+        if (header->keyLen == 0 || header->keyLen > KV_MAX_KEY_LEN || header->valueLen > KV_MAX_VALUE_LEN) break;
+
+        size_t size = sizeof(KeyValueRecord_t) + header->keyLen + header->valueLen;
+        size_t rest = size - sizeof(KeyValueRecord_t);
+        if (off + size > fileSize) break;
+        if (!readLog(file, off + sizeof(KeyValueRecord_t), scratch + sizeof(KeyValueRecord_t), rest)) break;
+        if (recordCrc(scratch, size) != header->crc) break;
+
+        if (!apply(scratch, off | (next ? KV_LOC_NEXT : 0))) return false;
+        off += size;
+    }
+
+    *clean = (off >= fileSize);
+    if (!*clean) ESP_LOGW(TAG, "Invalid record at %s:%u, ignoring %u trailing byte(s)", file.path(), off, fileSize - off);
+    return true;
+}
+
+bool KeyValueStore::loadCheckpoint(bool* resume) {
+    char path[KV_MAX_PATH_LEN];
+    indexPath(path, false);
+
+    KeyValueCheckpoint_t header;
+    size_t n = 0;
+    if (storage->read(fs, path, (uint8_t*)&header, sizeof(header), 0, &n) != STORAGE_OK || n != sizeof(header) ||
+        header.magic != KV_CHECKPOINT_MAGIC || header.version != KV_CHECKPOINT_VERSION) {
+        return false;
+    }
+
+    // A compacting checkpoint refers to records of the next generation
+    if (header.flags & KV_CHECKPOINT_FLAG_COMPACTING) {
+        char next[KV_MAX_PATH_LEN];
+        logPath(header.gen + 1, next);
+        if (!storage->exists(fs, next)) return false;
+    }
+
+    if (header.capacity > capacity && (header.capacity & (header.capacity - 1)) == 0) {
+        Slot_t* newSlots = (Slot_t*)calloc(header.capacity, sizeof(Slot_t));
+        if (newSlots != NULL) {
+            free(slots);
+            slots = newSlots;
+            capacity = header.capacity;
+        }
+    }
+
+    uint32_t crc = esp_rom_crc32_le(0, (const uint8_t*)&header, sizeof(header));
+    uint32_t pos = sizeof(header);
+    uint32_t remaining = header.count;
+    bool res = true;
+    while (remaining && res) {
+        uint32_t batch = KV_SCRATCH_SIZE / sizeof(Slot_t);
+        if (batch > remaining) batch = remaining;
+
+        size_t len = batch * sizeof(Slot_t);
+        res = (storage->read(fs, path, scratch, len, pos, &n) == STORAGE_OK) && (n == len);
+        if (!res) break;
+        crc = esp_rom_crc32_le(crc, scratch, len);
+
+        for (uint32_t i = 0; i < batch && res; i++) {
+            Slot_t slot;
+            memcpy(&slot, scratch + i * sizeof(Slot_t), sizeof(Slot_t));
+            res = insert(slot);
+        }
+        pos += len;
+        remaining -= batch;
+    }
+
+    uint32_t expected = 0;
+    if (res) {
+        res = (storage->read(fs, path, (uint8_t*)&expected, sizeof(expected), pos, &n) == STORAGE_OK) &&
+              (n == sizeof(expected)) && (expected == crc);
+    }
+
+    if (!res) {
+        memset(slots, 0, capacity * sizeof(Slot_t));
+        count = 0;
+        liveBytes = 0;
+        return false;
+    }
+
+    gen = header.gen;
+    logSize = header.logSize;
+    *resume = (header.flags & KV_CHECKPOINT_FLAG_COMPACTING) != 0;
+    nextSize = *resume ? header.nextSize : 0;
+    return true;
+}
+
+bool KeyValueStore::writeCheckpoint() {
+    // The end of a log that cannot be reopened is unknown, its tail would not be covered
+    if ((!logFile && !reopenLog(false)) || (compacting && !nextFile && !reopenLog(true))) return false;
+
+    char temp[KV_MAX_PATH_LEN];
+    char path[KV_MAX_PATH_LEN];
+    indexPath(temp, true);
+    indexPath(path, false);
+
+    KeyValueCheckpoint_t header = {
+        .magic = KV_CHECKPOINT_MAGIC,
+        .version = KV_CHECKPOINT_VERSION,
+        .flags = (uint16_t)(compacting ? KV_CHECKPOINT_FLAG_COMPACTING : 0),
+        .gen = gen,
+        .logSize = logSize,
+        .nextSize = compacting ? nextSize : 0,
+        .capacity = capacity,
+        .count = count,
+    };
+
+    uint32_t crc = esp_rom_crc32_le(0, (const uint8_t*)&header, sizeof(header));
+    if (!storage->write(fs, temp, (const uint8_t*)&header, sizeof(header))) return false;
+
+    size_t used = 0;
+    for (uint32_t i = 0; i <= capacity; i++) {
+        bool last = (i == capacity);
+        if (!last && slots[i].size) {
+            memcpy(scratch + used, &slots[i], sizeof(Slot_t));
+            used += sizeof(Slot_t);
+        }
+
+        if (used && (last || used + sizeof(Slot_t) > KV_SCRATCH_SIZE)) {
+            crc = esp_rom_crc32_le(crc, scratch, used);
+            if (!storage->append(fs, temp, scratch, used)) return false;
+            used = 0;
+        }
+    }
+
+    // Rename is atomic on LittleFS, a crash leaves either the old or the new checkpoint
+    if (!storage->append(fs, temp, (const uint8_t*)&crc, sizeof(crc)) || !storage->mv(fs, temp, path)) return false;
+    updates = 0;
+    unsafeTail = false;
+    checkpointDue = false;
+
+    // The previous generation is only needed until a checkpoint of its successor exists
+    if (gen > 0) {
+        logPath(gen - 1, path);
+        if (storage->exists(fs, path)) storage->rm(fs, path);
+    }
+
+    ESP_LOGD(TAG, "Checkpoint written, %u key(s), generation %u", count, gen);
+    return true;
+}
+
+// Replay stops at the first invalid record, nothing may be appended behind one
+// until a checkpoint past it exists
+bool KeyValueStore::prepareAppend() {
+    return !unsafeTail || writeCheckpoint();
+}
+
+bool KeyValueStore::appendRecord(uint16_t size, uint32_t* loc) {
+    uint32_t end = compacting ? nextSize : logSize;
+    if (!appendLog(compacting, scratch, size)) {
+        // Get the background task to checkpoint past whatever the failed append left
+        if (unsafeTail && task) xTaskNotifyGive(task);
+        return false;
+    }
+
+    *loc = end | (compacting ? KV_LOC_NEXT : 0);
+    return true;
+}
+
+void KeyValueStore::afterUpdate() {
+    updates++;
+
+    if (!compacting && logSize >= config.compactMinSize &&
+        (uint64_t)(logSize - liveBytes) * 100 >= (uint64_t)logSize * config.compactThreshold) {
+        startCompaction();
+    } else if (config.checkpointInterval && updates >= config.checkpointInterval && task) {
+        xTaskNotifyGive(task);
+    }
+}
+
+void KeyValueStore::startCompaction() {
+    if (compacting) return;
+
+    char path[KV_MAX_PATH_LEN];
+    if (gen > 0) {
+        logPath(gen - 1, path);
+        if (storage->exists(fs, path) && !writeCheckpoint()) {
+            ESP_LOGE(TAG, "Failed to checkpoint previous compaction, not compacting");
+            return;
+        }
+    }
+
+    if (!openLog(gen + 1, &nextFile)) return;
+
+    compacting = true;
+    nextSize = nextFile.size();
+    cursor = 0;
+    pendingMoves = count;
+    ESP_LOGD(TAG, "Compacting generation %u, %u of %u byte(s) live", gen, liveBytes, logSize);
+
+    if (task) xTaskNotifyGive(task);
+}
+
+bool KeyValueStore::compactStep() {
+    if (!prepareAppend()) return false;
+
+    uint32_t batch = config.compactBatch;
+    if (batch == 0 || batch > KV_MAX_COMPACT_BATCH) batch = KV_MAX_COMPACT_BATCH;
+
+    // Read a batch of live records from the old log and move them with a single append
+    uint32_t moves[KV_MAX_COMPACT_BATCH];
+    uint32_t moved = 0;
+    size_t used = 0;
+    for (uint32_t scanned = 0; moved < batch && pendingMoves > moved && scanned < capacity; scanned++) {
+        if (cursor >= capacity) cursor = 0;
+        Slot_t& slot = slots[cursor];
+
+        if (slot.size && !(slot.loc & KV_LOC_NEXT)) {
+            if (used + slot.size > KV_SCRATCH_SIZE) break;
+
+            if (!readLog(logFile, slot.loc, scratch + used, slot.size)) {
+                ESP_LOGE(TAG, "Failed to read record for compaction at %s:%u", logFile.path(), slot.loc);
+                return false;
+            }
+            moves[moved++] = cursor;
+            used += slot.size;
+        }
+        cursor++;
+    }
+
+    if (moved == 0 && pendingMoves) {
+        ESP_LOGW(TAG, "No record left to move, %u expected", pendingMoves);
+        pendingMoves = 0;
+    }
+
+    if (used) {
+        uint32_t loc = nextSize;
+        if (!appendLog(true, scratch, used)) return false;
+
+        for (uint32_t i = 0; i < moved; i++) {
+            Slot_t& slot = slots[moves[i]];
+            slot.loc = loc | KV_LOC_NEXT;
+            loc += slot.size;
+        }
+        pendingMoves -= moved;
+    }
+
+    if (pendingMoves == 0) return finishCompaction();
+    return true;
+}
+
+bool KeyValueStore::finishCompaction() {
+    for (uint32_t i = 0; i < capacity; i++) slots[i].loc &= ~KV_LOC_NEXT;
+
+    logFile.close();
+    logFile = nextFile;
+    nextFile = File();
+    gen++;
+    logSize = nextSize;
+    compacting = false;
+    compactions++;
+
+    // Until this succeeds the old log stays on disk and recovery resumes from it
+    if (!writeCheckpoint()) {
+        ESP_LOGE(TAG, "Failed to checkpoint compacted generation %u", gen);
+        checkpointDue = true;
+        return false;
+    }
+
+    ESP_LOGD(TAG, "Compaction done, generation %u, %u byte(s)", gen, logSize);
+    return true;
+}
+
+void KeyValueStore::compactTask(void* arg) {
+    KeyValueStore* kv = (KeyValueStore*)arg;
+    uint32_t backoff_ms = 0;
+
+    while (!kv->stopping) {
+        // After a failure the task wakes up on its own, nothing else may ever notify it
+        ulTaskNotifyTake(pdTRUE, backoff_ms ? pdMS_TO_TICKS(backoff_ms) : portMAX_DELAY);
+
+        while (!kv->stopping) {
+            xSemaphoreTake(kv->mutex, portMAX_DELAY);
+            bool res = true;
+            bool more = false;
+            if (kv->compacting) {
+                res = kv->compactStep();
+                more = res && kv->compacting;
+            } else if (kv->unsafeTail || kv->checkpointDue ||
+                       (kv->config.checkpointInterval && kv->updates >= kv->config.checkpointInterval)) {
+                res = kv->writeCheckpoint();
+            }
+            xSemaphoreGive(kv->mutex);
+
+            if (!res) {
+                backoff_ms = backoff_ms ? backoff_ms * 2 : KV_RETRY_MIN_MS;
+                if (backoff_ms > KV_RETRY_MAX_MS) backoff_ms = KV_RETRY_MAX_MS;
+                ESP_LOGW(TAG, "Background %s failed, retrying in %u ms", kv->compacting ? "compaction" : "checkpoint", backoff_ms);
+                break;
+            }
+            backoff_ms = 0;
+
+            if (!more) break;
+            // Let foreground gets and puts in between compaction steps
+            vTaskDelay(1);
+        }
+    }
+
+    xSemaphoreGive(kv->stopped);
+    vTaskDelete(NULL);
+}
+
+bool KeyValueStore::init(EspDataStorage* storage, Partition_t* fs, const char* dirname, const KeyValueConfig_t& config) {
+    assert(storage != NULL && "EspDataStorage is NULL, invalid argument.");
+    assert(fs != NULL && "Partition object is NULL, invalid argument.");
+
+    if (strlen(dirname) >= KV_MAX_DIRNAME_LEN) {
+        ESP_LOGE(TAG, "Directory name too long: %s", dirname);
+        return false;
+    }
+
+    this->storage = storage;
+    this->fs = fs;
+    this->config = config;
+    strcpy(this->dirname, dirname);
+
+    capacity = KV_MIN_CAPACITY;
+    while (capacity < config.capacity) capacity *= 2;
+    count = 0;
+    liveBytes = 0;
+    gen = 0;
+    logSize = 0;
+    updates = 0;
+    compactions = 0;
+    compacting = false;
+    nextSize = 0;
+    cursor = 0;
+    pendingMoves = 0;
+    unsafeTail = false;
+    checkpointDue = false;
+    task = NULL;
+    stopping = false;
+
+    slots = (Slot_t*)calloc(capacity, sizeof(Slot_t));
+    scratch = (uint8_t*)malloc(KV_SCRATCH_SIZE);
+    mutex = xSemaphoreCreateMutex();
+    stopped = xSemaphoreCreateBinary();
+    if (slots == NULL || scratch == NULL || mutex == NULL || stopped == NULL) {
+        ESP_LOGE(TAG, "Failed to initialize KeyValueStore, possibly run out of memory.");
+        done();
+        return false;
+    }
+
+    if (!storage->exists(fs, dirname) && !storage->mkdir(fs, dirname)) {
+        ESP_LOGE(TAG, "Failed to create directory: %s", dirname);
+        done();
+        return false;
+    }
+
+    char path[KV_MAX_PATH_LEN];
+    indexPath(path, false);
+    bool resume = false;
+    bool hasIndex = storage->exists(fs, path);
+    if (!hasIndex || !loadCheckpoint(&resume)) {
+        // Rebuild from the newest generation on disk, the checkpoint may not even name it
+        if (!scanGenerations(&gen)) gen = 0;
+        if (hasIndex) ESP_LOGW(TAG, "Invalid checkpoint, rebuilding index from generation %u", gen);
+        logSize = 0;
+        nextSize = 0;
+        resume = false;
+    }
+
+    // Only the records appended after the checkpoint need to be replayed
+    bool clean = true;
+    if (!openLog(gen, &logFile) || !replay(logFile, logSize, false, &clean)) {
+        done();
+        return false;
+    }
+    logSize = logFile.size();
+
+    if (gen > 0) {
+        logPath(gen - 1, path);
+        if (storage->exists(fs, path)) storage->rm(fs, path);
+    }
+
+    // The next generation only exists while a compaction is in progress, resume it
+    logPath(gen + 1, path);
+    if (resume || storage->exists(fs, path)) {
+        bool nextClean = true;
+        if (!openLog(gen + 1, &nextFile) || !replay(nextFile, nextSize, true, &nextClean)) {
+            done();
+            return false;
+        }
+
+        clean = clean && nextClean;
+        compacting = true;
+        nextSize = nextFile.size();
+        cursor = 0;
+        pendingMoves = 0;
+        for (uint32_t i = 0; i < capacity; i++) {
+            if (slots[i].size && !(slots[i].loc & KV_LOC_NEXT)) pendingMoves++;
+        }
+    }
+
+    // Writes wait for a checkpoint past any invalid tail, see prepareAppend()
+    unsafeTail = !clean;
+    if (updates || unsafeTail) writeCheckpoint();
+
+    if (xTaskCreate(compactTask, "kv compact", config.taskStackSize, this, config.taskPriority, &task) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create compaction task");
+        task = NULL;
+        done();
+        return false;
+    }
+    if (compacting || unsafeTail) xTaskNotifyGive(task);
+
+    ESP_LOGI(TAG, "Opened %s, %u key(s), generation %u", dirname, count, gen);
+    return true;
+}
+
+void KeyValueStore::done() {
+    bool opened = (task != NULL);
+    if (task) {
+        stopping = true;
+        xTaskNotifyGive(task);
+        xSemaphoreTake(stopped, portMAX_DELAY);
+        task = NULL;
+    }
+
+    if (opened && (updates || unsafeTail || checkpointDue)) writeCheckpoint();
+    logFile.close();
+    nextFile.close();
+
+    free(slots);
+    free(scratch);
+    if (mutex != NULL) vSemaphoreDelete(mutex);
+    if (stopped != NULL) vSemaphoreDelete(stopped);
+    slots = NULL;
+    scratch = NULL;
+    mutex = NULL;
+    stopped = NULL;
+}
+
+StorageErr_t KeyValueStore::get(const char* key, void* value, size_t len, size_t* valueLen) {
+    size_t keyLen;
+    if (!validKey(key, &keyLen)) return STORAGE_FAIL;
+    uint64_t hash = hashKey(key, keyLen);
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    int index = find((uint32_t)hash, (uint16_t)(hash >> 32));
+    if (index < 0) {
+        xSemaphoreGive(mutex);
+        return STORAGE_NOT_FOUND;
+    }
+
+    Slot_t slot = slots[index];
+    File& file = (slot.loc & KV_LOC_NEXT) ? nextFile : logFile;
+    bool res = readLog(file, slot.loc & ~KV_LOC_NEXT, scratch, slot.size);
+    const KeyValueRecord_t* header = (const KeyValueRecord_t*)scratch;
+    if (!res || recordCrc(scratch, slot.size) != header->crc ||
+        header->keyLen != keyLen || memcmp(scratch + sizeof(KeyValueRecord_t), key, keyLen) != 0) {
+        ESP_LOGE(TAG, "Failed to read record of key: %s", key);
+        xSemaphoreGive(mutex);
+        return STORAGE_FAIL;
+    }
+
+    size_t copyLen = (header->valueLen < len) ? header->valueLen : len;
+    memcpy(value, scratch + sizeof(KeyValueRecord_t) + keyLen, copyLen);
+    if (valueLen) *valueLen = header->valueLen;
+    bool truncated = copyLen < header->valueLen;
+    xSemaphoreGive(mutex);
+
+    return truncated ? STORAGE_READ_MAX_BUFFER : STORAGE_OK;
+}
+
+bool KeyValueStore::put(const char* key, const void* value, size_t len) {
+    size_t keyLen;
+    if (!validKey(key, &keyLen) || len > KV_MAX_VALUE_LEN) {
+        ESP_LOGE(TAG, "Invalid key or value length");
+        return false;
+    }
+    uint64_t hash = hashKey(key, keyLen);
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    if (!prepareAppend()) {
+        ESP_LOGE(TAG, "Log tail not checkpointed yet, rejecting key: %s", key);
+        xSemaphoreGive(mutex);
+        return false;
+    }
+
+    KeyValueRecord_t* header = (KeyValueRecord_t*)scratch;
+    header->keyLen = keyLen;
+    header->flags = 0;
+    header->valueLen = len;
+    memcpy(scratch + sizeof(KeyValueRecord_t), key, keyLen);
+    memcpy(scratch + sizeof(KeyValueRecord_t) + keyLen, value, len);
+
+    uint16_t size = sizeof(KeyValueRecord_t) + keyLen + len;
+    header->crc = recordCrc(scratch, size);
+
+    uint32_t loc;
+    if (!appendRecord(size, &loc)) {
+        ESP_LOGE(TAG, "Failed to append record of key: %s", key);
+        xSemaphoreGive(mutex);
+        return false;
+    }
+
+    Slot_t slot = {
+        .hash = (uint32_t)hash,
+        .tag = (uint16_t)(hash >> 32),
+        .size = size,
+        .loc = loc,
+    };
+    bool res = insert(slot);
+    afterUpdate();
+    xSemaphoreGive(mutex);
+    return res;
+}
+
+bool KeyValueStore::del(const char* key) {
+    size_t keyLen;
+    if (!validKey(key, &keyLen)) return false;
+    uint64_t hash = hashKey(key, keyLen);
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    int index = find((uint32_t)hash, (uint16_t)(hash >> 32));
+    if (index < 0) {
+        xSemaphoreGive(mutex);
+        return false;
+    }
+
+    if (!prepareAppend()) {
+        ESP_LOGE(TAG, "Log tail not checkpointed yet, rejecting key: %s", key);
+        xSemaphoreGive(mutex);
+        return false;
+    }
+
+    KeyValueRecord_t* header = (KeyValueRecord_t*)scratch;
+    header->keyLen = keyLen;
+    header->flags = KV_RECORD_TOMBSTONE;
+    header->valueLen = 0;
+    memcpy(scratch + sizeof(KeyValueRecord_t), key, keyLen);
+
+    uint16_t size = sizeof(KeyValueRecord_t) + keyLen;
+    header->crc = recordCrc(scratch, size);
+
+    uint32_t loc;
+    if (!appendRecord(size, &loc)) {
+        ESP_LOGE(TAG, "Failed to append tombstone of key: %s", key);
+        xSemaphoreGive(mutex);
+        return false;
+    }
+
+    erase(index);
+    afterUpdate();
+    xSemaphoreGive(mutex);
+    return true;
+}
+
+bool KeyValueStore::exists(const char* key) {
+    size_t keyLen;
+    if (!validKey(key, &keyLen)) return false;
+    uint64_t hash = hashKey(key, keyLen);
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    bool res = find((uint32_t)hash, (uint16_t)(hash >> 32)) >= 0;
+    xSemaphoreGive(mutex);
+    return res;
+}
+
+bool KeyValueStore::checkpoint() {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    bool res = writeCheckpoint();
+    xSemaphoreGive(mutex);
+    return res;
+}
+
+bool KeyValueStore::compact() {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    startCompaction();
+    bool res = compacting;
+    while (res && compacting) {
+        res = compactStep();
+        // Release the lock between steps so other callers are not starved
+        xSemaphoreGive(mutex);
+        xSemaphoreTake(mutex, portMAX_DELAY);
+    }
+    xSemaphoreGive(mutex);
+
+    // Whatever failed here is retried by the background task
+    if (!res && task) xTaskNotifyGive(task);
+    return res;
+}
+
+KeyValueStats_t KeyValueStore::getStats() {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    KeyValueStats_t stats = {
+        .count = count,
+        .capacity = capacity,
+        .liveBytes = liveBytes,
+        .logBytes = logSize + (compacting ? nextSize : 0),
+        .compactions = compactions,
+        .compacting = compacting,
+    };
+    xSemaphoreGive(mutex);
+    return stats;
+}
@@ -4,8 +4,12 @@
 
 #include <cstring>
 
+#define MAX_CACHED_DEVICE 4
+
 static const char* TAG = "SPIFlash";
 
+static SPIFlash* cachedDevices[MAX_CACHED_DEVICE] = {NULL};
+
 esp_err_t SPIFlash::initSPIbus() {
 #ifdef CONFIG_IDF_TARGET_ESP32S3
     spiBusConfig.miso_io_num = SPI2_IOMUX_PIN_NUM_MISO;
@@ -110,5 +114,147 @@ bool SPIFlash::install() {
 }
 
 bool SPIFlash::uninstall() {
+    if (cache) {
+        lockChip();
+        device->chip_drv = chipDriver;
+        unlockChip();
+
+        for (uint8_t i = 0; i < MAX_CACHED_DEVICE; i++) {
+            if (cachedDevices[i] == this) cachedDevices[i] = NULL;
+        }
+        cache->done();
+        cache.reset();
+    }
+    return true;
+}
+
+// Same locking esp_flash_* functions do before touching the chip driver
+void SPIFlash::lockChip() {
+    if (device->os_func != NULL && device->os_func->start != NULL) {
+        device->os_func->start(device->os_func_data);
+    }
+    device->host->driver->dev_config(device->host);
+}
+
+void SPIFlash::unlockChip() {
+    if (device->os_func != NULL && device->os_func->end != NULL) {
+        device->os_func->end(device->os_func_data);
+    }
+}
+
+SPIFlash* SPIFlash::fromChip(esp_flash_t* chip) {
+    for (uint8_t i = 0; i < MAX_CACHED_DEVICE; i++) {
+        if (cachedDevices[i] != NULL && cachedDevices[i]->device == chip) return cachedDevices[i];
+    }
+    return NULL;
+}
+
+esp_err_t SPIFlash::backendRead(void* ctx, uint32_t address, void* dest, uint32_t len) {
+    SPIFlash* flash = (SPIFlash*)ctx;
+    return flash->chipDriver->read(flash->device, dest, address, len);
+}
+
+esp_err_t SPIFlash::backendProgram(void* ctx, uint32_t address, const void* src, uint32_t len) {
+    SPIFlash* flash = (SPIFlash*)ctx;
+    return flash->chipDriver->write(flash->device, src, address, len);
+}
+
+// Chip driver hooks below are called by esp_flash with the chip lock held,
+// which also serializes every access to the block cache.
+esp_err_t SPIFlash::cachedRead(esp_flash_t* chip, void* buffer, uint32_t address, uint32_t length) {
+    return fromChip(chip)->cache->read(address, buffer, length);
+}
+
+esp_err_t SPIFlash::cachedWrite(esp_flash_t* chip, const void* buffer, uint32_t address, uint32_t length) {
+    return fromChip(chip)->cache->program(address, buffer, length);
+}
+
+esp_err_t SPIFlash::cachedEraseChip(esp_flash_t* chip) {
+    SPIFlash* flash = fromChip(chip);
+    esp_err_t ret = flash->chipDriver->erase_chip(chip);
+    if (ret == ESP_OK) {
+        flash->cache->erase(0, flash->info.capacity);
+    } else {
+        flash->cache->invalidate(0, flash->info.capacity);
+    }
+    return ret;
+}
+
+esp_err_t SPIFlash::cachedEraseSector(esp_flash_t* chip, uint32_t address) {
+    SPIFlash* flash = fromChip(chip);
+    esp_err_t ret = flash->chipDriver->erase_sector(chip, address);
+    if (ret == ESP_OK) {
+        flash->cache->erase(address, flash->chipDriver->sector_size);
+    } else {
+        flash->cache->invalidate(address, flash->chipDriver->sector_size);
+    }
+    return ret;
+}
+
+esp_err_t SPIFlash::cachedEraseBlock(esp_flash_t* chip, uint32_t address) {
+    SPIFlash* flash = fromChip(chip);
+    esp_err_t ret = flash->chipDriver->erase_block(chip, address);
+    if (ret == ESP_OK) {
+        flash->cache->erase(address, flash->chipDriver->block_erase_size);
+    } else {
+        flash->cache->invalidate(address, flash->chipDriver->block_erase_size);
+    }
+    return ret;
+}
+
+bool SPIFlash::enableCache(const StorageCacheConfig_t& config) {
+    if (info.status != STORAGE_DEVICE_ONLINE) {
+        ESP_LOGE(TAG, "Failed to enable cache, flash is not installed");
+        return false;
+    }
+
+    if (cache) {
+        ESP_LOGW(TAG, "Block cache has been enabled.");
+        return false;
+    }
+
+    uint8_t slot = MAX_CACHED_DEVICE;
+    for (uint8_t i = 0; i < MAX_CACHED_DEVICE; i++) {
+        if (cachedDevices[i] == NULL) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot == MAX_CACHED_DEVICE) {
+        ESP_LOGE(TAG, "Failed to enable cache, too many cached devices");
+        return false;
+    }
+
+    cache = std::unique_ptr<BlockCache>(new BlockCache());
+    if (!cache->init(config, info.capacity, backendRead, backendProgram, this)) {
+        cache.reset();
+        return false;
+    }
+    cachedDevices[slot] = this;
+
+    // Interpose the cache between esp_flash and the chip driver, so every user
+    // of the chip (LittleFS through esp_partition included) goes through it.
+    lockChip();
+    chipDriver = device->chip_drv;
+    cachedDriver = *chipDriver;
+    cachedDriver.read = cachedRead;
+    cachedDriver.write = cachedWrite;
+    cachedDriver.erase_chip = cachedEraseChip;
+    cachedDriver.erase_sector = cachedEraseSector;
+    cachedDriver.erase_block = cachedEraseBlock;
+    device->chip_drv = &cachedDriver;
+    unlockChip();
+
+    return true;
+}
+
+// The counters are updated by the chip driver hooks, so they are only consistent under the chip lock
+bool SPIFlash::getCacheStats(StorageCacheStats_t* stats, bool reset) {
+    if (!cache) return false;
+
+    lockChip();
+    *stats = cache->getStats();
+    if (reset) cache->resetStats();
+    unlockChip();
     return true;
-}
\ No newline at end of file
+}
@@ -37,3 +37,15 @@ void StorageDevice::printInfo() {
 StorageDeviceInfo_t StorageDevice::getInfo() {
     return info;
 }
+
+bool StorageDevice::enableCache(const StorageCacheConfig_t& config) {
+    ESP_LOGW(TAG, "Block cache is not supported by %s device", storageDeviceTypeToName(info.type));
+    return false;
+}
+
+bool StorageDevice::getCacheStats(StorageCacheStats_t* stats, bool reset) {
+    if (!cache) return false;
+    *stats = cache->getStats();
+    if (reset) cache->resetStats();
+    return true;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#define BENCH_MAX_PARTITIONS 2
+
+/*
+ * Storage backend driven by the benchmark. Partitions are addressed by index
+ * so the same workload can run against EspDataStorage on hardware and against
+ * plain LittleFS on emulated flash when built for the Linux target. The Linux
+ * run never goes through EspDataStorage, it is a LittleFS baseline only.
+ */
+class BenchTarget {
+   public:
+    virtual ~BenchTarget() = default;
+
+    virtual bool setup(uint8_t partitions) = 0;
+    virtual void teardown() = 0;
+    virtual const char* name() = 0;
+
+    virtual bool mkfile(uint8_t part, const char* path) = 0;
+    virtual bool rm(uint8_t part, const char* path) = 0;
+    virtual size_t fsize(uint8_t part, const char* path) = 0;
+    virtual bool append(uint8_t part, const char* path, const char* data) = 0;
+    virtual bool write(uint8_t part, const char* path, const char* data) = 0;
+    // Reads up to len bytes from pos into dest, which must hold len + 2 bytes.
+    // Returns the number of bytes read or -1 on failure.
+    virtual int read(uint8_t part, const char* path, char* dest, uint32_t len, uint32_t pos) = 0;
+};
+
+BenchTarget* createBenchTarget();
@@ -0,0 +1,319 @@
+#include "Benchmark.h"
+
+#include <esp_log.h>
+#include <freertos/task.h>
+#include <sdkconfig.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef CONFIG_IDF_TARGET_LINUX
+#include <time.h>
+#else
+#include <esp_timer.h>
+#endif
+
+#define BENCH_TASK_STACK_SIZE (1024 * 8)
+#define BENCH_TASK_PRIORITY 5
+#define CHURN_WINDOW 8
+#define MAX_PATH_LEN 24
+
+static const char* TAG = "bench";
+
+static const char* opNames[BENCH_OP_MAX] = {
+    "append",
+    "read",
+    "read tail",
+    "create",
+    "delete",
+    "seq write",
+};
+
+static uint64_t benchNowUs() {
+#ifdef CONFIG_IDF_TARGET_LINUX
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+    return esp_timer_get_time();
+#endif
+}
+
+static uint32_t nextRandom(uint32_t* state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+// Only the operations a role performs get sample storage
+static bool roleRecords(BenchRole_t role, uint8_t op) {
+    switch (role) {
+        case BENCH_ROLE_WRITER:
+            return op == BENCH_OP_APPEND;
+        case BENCH_ROLE_READER:
+            return op == BENCH_OP_READ_FULL || op == BENCH_OP_READ_TAIL;
+        case BENCH_ROLE_CHURN:
+            return op == BENCH_OP_CREATE || op == BENCH_OP_DELETE;
+        case BENCH_ROLE_SEQ_WRITER:
+            return op == BENCH_OP_SEQ_WRITE;
+    }
+    return false;
+}
+
+static char* makePayload(size_t len, char fill) {
+    char* payload = (char*)malloc(len + 1);
+    if (payload == NULL) return NULL;
+    memset(payload, fill, len);
+    payload[len - 1] = '\n';
+    payload[len] = 0;
+    return payload;
+}
+
+static void writerPath(char* dest, uint8_t index) {
+    snprintf(dest, MAX_PATH_LEN, "/w%u.log", index);
+}
+
+void Benchmark::taskEntry(void* arg) {
+    BenchTask_t* task = (BenchTask_t*)arg;
+    Benchmark* bench = task->bench;
+
+    switch (task->role) {
+        case BENCH_ROLE_WRITER:
+            bench->writer(task);
+            break;
+        case BENCH_ROLE_READER:
+            bench->reader(task);
+            break;
+        case BENCH_ROLE_CHURN:
+            bench->churn(task);
+            break;
+        case BENCH_ROLE_SEQ_WRITER:
+            bench->seqWriter(task);
+            break;
+    }
+
+    xSemaphoreGive(bench->finished);
+    vTaskDelete(NULL);
+}
+
+void Benchmark::writer(BenchTask_t* task) {
+    uint8_t part = task->index % config.partitions;
+    char path[MAX_PATH_LEN];
+    writerPath(path, task->index);
+
+    char* payload = makePayload(config.appendSize, 'a' + (task->index % 26));
+    if (payload == NULL) return;
+
+    size_t fileSize = target->fsize(part, path);
+    while (running) {
+        uint64_t start = benchNowUs();
+        bool ok = target->append(part, path, payload);
+        task->recorders[BENCH_OP_APPEND].record(benchNowUs() - start, config.appendSize, ok);
+
+        // Start over instead of deleting so readers never see the file missing
+        fileSize += config.appendSize;
+        if (fileSize >= config.maxFileSize) {
+            target->write(part, path, "\n");
+            fileSize = 1;
+        }
+
+        vTaskDelay(config.writerDelay_ms ? pdMS_TO_TICKS(config.writerDelay_ms) : 1);
+    }
+    free(payload);
+}
+
+void Benchmark::reader(BenchTask_t* task) {
+    char* buffer = (char*)malloc(config.readBufferSize + 2);
+    if (buffer == NULL) return;
+
+    uint8_t files = config.writers ? config.writers : 1;
+    bool tail = task->index & 1;
+    while (running) {
+        uint8_t index = nextRandom(&task->rng) % files;
+        uint8_t part = index % config.partitions;
+        char path[MAX_PATH_LEN];
+        writerPath(path, index);
+
+        if (tail) {
+            uint64_t start = benchNowUs();
+            size_t size = target->fsize(part, path);
+            uint32_t pos = (size > config.tailSize) ? size - config.tailSize : 0;
+            int len = target->read(part, path, buffer, config.tailSize, pos);
+            task->recorders[BENCH_OP_READ_TAIL].record(benchNowUs() - start, len, len >= 0);
+        } else {
+            // Whole file in buffer sized chunks, a short chunk marks the end
+            uint64_t start = benchNowUs();
+            uint32_t total = 0;
+            int len;
+            do {
+                len = target->read(part, path, buffer, config.readBufferSize, total);
+                if (len > 0) total += len;
+            } while (len == (int)config.readBufferSize);
+            task->recorders[BENCH_OP_READ_FULL].record(benchNowUs() - start, total, len >= 0);
+        }
+
+        tail = !tail;
+        vTaskDelay(1);
+    }
+    free(buffer);
+}
+
+void Benchmark::churn(BenchTask_t* task) {
+    uint8_t part = task->index % config.partitions;
+    char* payload = makePayload(config.appendSize, 'c');
+    if (payload == NULL) return;
+
+    // Keeps a window of files alive so directory lookups have entries to walk
+    uint32_t created = 0;
+    while (running) {
+        char path[MAX_PATH_LEN];
+        snprintf(path, sizeof(path), "/c%u_%u", task->index, created % CHURN_WINDOW);
+
+        if (created >= CHURN_WINDOW) {
+            uint64_t start = benchNowUs();
+            bool ok = target->rm(part, path);
+            task->recorders[BENCH_OP_DELETE].record(benchNowUs() - start, 0, ok);
+        }
+
+        uint64_t start = benchNowUs();
+        bool ok = target->mkfile(part, path) && target->write(part, path, payload);
+        task->recorders[BENCH_OP_CREATE].record(benchNowUs() - start, config.appendSize, ok);
+
+        created++;
+        vTaskDelay(1);
+    }
+
+    for (uint32_t i = 0; i < CHURN_WINDOW && i < created; i++) {
+        char path[MAX_PATH_LEN];
+        snprintf(path, sizeof(path), "/c%u_%u", task->index, i);
+        target->rm(part, path);
+    }
+    free(payload);
+}
+
+void Benchmark::seqWriter(BenchTask_t* task) {
+    uint8_t part = task->index % config.partitions;
+    char path[MAX_PATH_LEN];
+    snprintf(path, sizeof(path), "/s%u.bin", task->index);
+
+    char* payload = makePayload(config.seqWriteSize, 's');
+    if (payload == NULL) return;
+
+    while (running) {
+        uint64_t start = benchNowUs();
+        bool ok = target->write(part, path, payload);
+        task->recorders[BENCH_OP_SEQ_WRITE].record(benchNowUs() - start, config.seqWriteSize, ok);
+        vTaskDelay(1);
+    }
+
+    target->rm(part, path);
+    free(payload);
+}
+
+bool Benchmark::run(BenchTarget* benchTarget, const BenchConfig_t& benchConfig) {
+    target = benchTarget;
+    config = benchConfig;
+    if (config.partitions == 0 || config.partitions > BENCH_MAX_PARTITIONS) config.partitions = 1;
+    if (config.tailSize > config.readBufferSize) config.tailSize = config.readBufferSize;
+
+    for (uint8_t op = 0; op < BENCH_OP_MAX; op++) totals[op].init(0, 0);
+    elapsed_us = 0;
+
+    if (!target->setup(config.partitions)) {
+        ESP_LOGE(TAG, "Failed to set up %s", target->name());
+        return false;
+    }
+
+    uint8_t files = config.writers ? config.writers : 1;
+    for (uint8_t i = 0; i < files; i++) {
+        char path[MAX_PATH_LEN];
+        writerPath(path, i);
+        target->mkfile(i % config.partitions, path);
+    }
+
+    uint32_t taskCount = config.writers + config.readers + config.churners + config.seqWriters;
+    BenchTask_t* tasks = new BenchTask_t[taskCount];
+    finished = xSemaphoreCreateCounting(taskCount ? taskCount : 1, 0);
+    if (finished == NULL) {
+        ESP_LOGE(TAG, "Failed to create benchmark semaphore");
+        delete[] tasks;
+        target->teardown();
+        return false;
+    }
+
+    uint32_t n = 0;
+    const struct {
+        BenchRole_t role;
+        uint8_t count;
+    } roles[] = {
+        {BENCH_ROLE_WRITER, config.writers},
+        {BENCH_ROLE_READER, config.readers},
+        {BENCH_ROLE_CHURN, config.churners},
+        {BENCH_ROLE_SEQ_WRITER, config.seqWriters},
+    };
+    for (const auto& role : roles) {
+        for (uint8_t i = 0; i < role.count; i++, n++) {
+            tasks[n].bench = this;
+            tasks[n].role = role.role;
+            tasks[n].index = i;
+            tasks[n].rng = config.seed * 2654435761u + n + 1;
+            for (uint8_t op = 0; op < BENCH_OP_MAX; op++) {
+                tasks[n].recorders[op].init(roleRecords(role.role, op) ? config.samples : 0, tasks[n].rng + op);
+            }
+        }
+    }
+
+    ESP_LOGI(TAG, "Running %u task(s) on %s for %u ms", taskCount, target->name(), config.duration_ms);
+
+    running = true;
+    uint64_t start = benchNowUs();
+    uint32_t started = 0;
+    for (n = 0; n < taskCount; n++) {
+        char name[16];
+        snprintf(name, sizeof(name), "bench%u", n);
+        if (xTaskCreate(taskEntry, name, BENCH_TASK_STACK_SIZE, &tasks[n], BENCH_TASK_PRIORITY, NULL) != pdPASS) {
+            ESP_LOGE(TAG, "Failed to start benchmark task %u", n);
+            break;
+        }
+        started++;
+    }
+
+    vTaskDelay(pdMS_TO_TICKS(config.duration_ms));
+    running = false;
+    for (uint32_t i = 0; i < started; i++) xSemaphoreTake(finished, portMAX_DELAY);
+    elapsed_us = benchNowUs() - start;
+
+    for (n = 0; n < started; n++) {
+        for (uint8_t op = 0; op < BENCH_OP_MAX; op++) totals[op].merge(tasks[n].recorders[op]);
+    }
+
+    for (uint8_t i = 0; i < files; i++) {
+        char path[MAX_PATH_LEN];
+        writerPath(path, i);
+        target->rm(i % config.partitions, path);
+    }
+
+    vSemaphoreDelete(finished);
+    delete[] tasks;
+    target->teardown();
+    return started == taskCount;
+}
+
+void Benchmark::report() {
+    double seconds = elapsed_us / 1000000.0;
+    if (seconds <= 0) return;
+
+    printf("\nTarget: %s, partitions: %u, duration: %.1f s\n", target->name(), config.partitions, seconds);
+    printf("%-10s %8s %6s %9s %9s %8s %8s %8s\n", "op", "count", "errors", "ops/s", "KB/s", "p50(us)", "p99(us)", "max(us)");
+
+    for (uint8_t op = 0; op < BENCH_OP_MAX; op++) {
+        LatencySummary_t s = totals[op].summarize();
+        if (s.count == 0 && s.errors == 0) continue;
+        printf("%-10s %8u %6u %9.1f %9.1f %8u %8u %8u\n", opNames[op], s.count, s.errors, s.count / seconds,
+               s.bytes / 1024.0 / seconds, s.p50_us, s.p99_us, s.max_us);
+    }
+}
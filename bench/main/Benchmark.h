@@ -0,0 +1,73 @@
+#pragma once
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#include <cstdint>
+
+#include "BenchTarget.h"
+#include "LatencyRecorder.h"
+
+typedef enum {
+    BENCH_OP_APPEND = 0,
+    BENCH_OP_READ_FULL,
+    BENCH_OP_READ_TAIL,
+    BENCH_OP_CREATE,
+    BENCH_OP_DELETE,
+    BENCH_OP_SEQ_WRITE,
+    BENCH_OP_MAX,
+} BenchOp_t;
+
+typedef enum {
+    BENCH_ROLE_WRITER = 0,
+    BENCH_ROLE_READER,
+    BENCH_ROLE_CHURN,
+    BENCH_ROLE_SEQ_WRITER,
+} BenchRole_t;
+
+typedef struct {
+    uint8_t partitions;
+    uint8_t writers;
+    uint16_t appendSize;
+    uint16_t writerDelay_ms;
+    uint8_t readers;
+    uint16_t tailSize;
+    uint32_t readBufferSize;
+    uint8_t churners;
+    uint8_t seqWriters;
+    uint32_t seqWriteSize;
+    uint32_t maxFileSize;
+    uint32_t duration_ms;
+    uint32_t samples;
+    uint32_t seed;
+} BenchConfig_t;
+
+class Benchmark;
+
+typedef struct {
+    Benchmark* bench;
+    BenchRole_t role;
+    uint8_t index;
+    uint32_t rng;
+    LatencyRecorder recorders[BENCH_OP_MAX];
+} BenchTask_t;
+
+class Benchmark {
+   private:
+    BenchTarget* target;
+    BenchConfig_t config;
+    SemaphoreHandle_t finished;
+    volatile bool running;
+    uint64_t elapsed_us;
+    LatencyRecorder totals[BENCH_OP_MAX];
+
+    static void taskEntry(void* arg);
+    void writer(BenchTask_t* task);
+    void reader(BenchTask_t* task);
+    void churn(BenchTask_t* task);
+    void seqWriter(BenchTask_t* task);
+
+   public:
+    bool run(BenchTarget* benchTarget, const BenchConfig_t& benchConfig);
+    void report();
+};
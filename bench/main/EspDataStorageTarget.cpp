@@ -0,0 +1,111 @@
+#include <esp_log.h>
+#include <sdkconfig.h>
+
+#include <cstring>
+
+#include "BenchTarget.h"
+#include "EspDataStorage.h"
+
+#define BENCH_EXTERNAL_DEVICE_ID 1
+
+static const char* TAG = "bench";
+
+static const char* partitionLabels[BENCH_MAX_PARTITIONS] = {
+    "bench0",
+#ifdef CONFIG_BENCH_EXTERNAL_FLASH
+    "exbench",
+#else
+    "bench1",
+#endif
+};
+
+static const char* partitionPaths[BENCH_MAX_PARTITIONS] = {"/bench0", "/bench1"};
+
+class EspDataStorageTarget : public BenchTarget {
+   private:
+    EspDataStorage storage;
+    Partition_t* fs[BENCH_MAX_PARTITIONS] = {NULL};
+    uint8_t partitions = 0;
+
+   public:
+    bool setup(uint8_t partitions) override {
+        if (!storage.init()) return false;
+
+#ifdef CONFIG_BENCH_EXTERNAL_FLASH
+        if (!storage.mkdev(BENCH_EXTERNAL_DEVICE_ID, STORAGE_DEVICE_TYPE_FLASH)) return false;
+#ifdef CONFIG_BENCH_EXTERNAL_CACHE
+        StorageCacheConfig_t cacheConfig = STORAGE_CACHE_CONFIG_DEFAULT();
+        storage.mkcache(BENCH_EXTERNAL_DEVICE_ID, cacheConfig);
+#endif
+        if (!storage.mkpartition(BENCH_EXTERNAL_DEVICE_ID, partitionLabels[1], 0x100000)) return false;
+#endif
+
+        for (uint8_t i = 0; i < partitions; i++) {
+            fs[i] = storage.mount(partitionLabels[i], partitionPaths[i], true);
+            if (fs[i] == NULL) {
+                ESP_LOGE(TAG, "Failed to mount partition: %s", partitionLabels[i]);
+                return false;
+            }
+            this->partitions = i + 1;
+        }
+
+#ifdef CONFIG_BENCH_EXTERNAL_CACHE
+        // Only count the workload, not the mount (and a possible format) above
+        StorageCacheStats_t stats;
+        storage.cachestat(BENCH_EXTERNAL_DEVICE_ID, &stats, true);
+#endif
+        return true;
+    }
+
+    void teardown() override {
+#ifdef CONFIG_BENCH_EXTERNAL_CACHE
+        StorageCacheStats_t stats;
+        if (storage.cachestat(BENCH_EXTERNAL_DEVICE_ID, &stats)) {
+            ESP_LOGI(TAG, "External flash cache hits: %u, misses: %u, evictions: %u, prefetches: %u, programs: %u",
+                     stats.hits, stats.misses, stats.evictions, stats.prefetches, stats.programs);
+        }
+#endif
+        for (uint8_t i = 0; i < partitions; i++) {
+            storage.unmount(fs[i]);
+            fs[i] = NULL;
+        }
+        storage.done();
+    }
+
+    const char* name() override {
+        return "EspDataStorage";
+    }
+
+    bool mkfile(uint8_t part, const char* path) override {
+        return storage.mkfile(fs[part], path);
+    }
+
+    bool rm(uint8_t part, const char* path) override {
+        return storage.rm(fs[part], path);
+    }
+
+    size_t fsize(uint8_t part, const char* path) override {
+        return storage.fsize(fs[part], path);
+    }
+
+    bool append(uint8_t part, const char* path, const char* data) override {
+        return storage.append(fs[part], path, data);
+    }
+
+    bool write(uint8_t part, const char* path, const char* data) override {
+        return storage.write(fs[part], path, data);
+    }
+
+    int read(uint8_t part, const char* path, char* dest, uint32_t len, uint32_t pos) override {
+        // The text read finds its write position with strlen(dest), so dest has to start zeroed
+        memset(dest, 0, len + 2);
+        StorageErr_t err = storage.read(fs[part], path, dest, len, 0, pos);
+        if (err != STORAGE_OK && err != STORAGE_READ_MAX_BUFFER) return -1;
+        dest[len] = 0;
+        return strlen(dest);
+    }
+};
+
+BenchTarget* createBenchTarget() {
+    return new EspDataStorageTarget();
+}
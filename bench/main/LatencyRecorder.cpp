@@ -0,0 +1,67 @@
+#include "LatencyRecorder.h"
+
+#include <algorithm>
+
+void LatencyRecorder::init(size_t capacity, uint32_t seed) {
+    samples.clear();
+    samples.reserve(capacity);
+    this->capacity = capacity;
+    count = 0;
+    errors = 0;
+    bytes = 0;
+    max_us = 0;
+    rng = seed ? seed : 1;
+}
+
+void LatencyRecorder::record(uint32_t latency_us, size_t bytes, bool success) {
+    if (!success) {
+        errors++;
+        return;
+    }
+
+    count++;
+    this->bytes += bytes;
+    if (latency_us > max_us) max_us = latency_us;
+
+    if (samples.size() < capacity) {
+        samples.push_back(latency_us);
+        return;
+    }
+
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    uint32_t slot = rng % count;
+    if (slot < capacity) samples[slot] = latency_us;
+}
+
+// The merged recorder takes over every sample of its input, which is left empty so
+// per-task and merged samples are never held twice. Only used for the final report.
+void LatencyRecorder::merge(LatencyRecorder& other) {
+    samples.reserve(samples.size() + other.samples.size());
+    samples.insert(samples.end(), other.samples.begin(), other.samples.end());
+    std::vector<uint32_t>().swap(other.samples);
+    capacity = samples.size();
+    count += other.count;
+    errors += other.errors;
+    bytes += other.bytes;
+    if (other.max_us > max_us) max_us = other.max_us;
+}
+
+LatencySummary_t LatencyRecorder::summarize() {
+    LatencySummary_t summary = {
+        .count = count,
+        .errors = errors,
+        .bytes = bytes,
+        .p50_us = 0,
+        .p99_us = 0,
+        .max_us = max_us,
+    };
+
+    if (samples.empty()) return summary;
+
+    std::sort(samples.begin(), samples.end());
+    summary.p50_us = samples[(samples.size() - 1) * 50 / 100];
+    summary.p99_us = samples[(samples.size() - 1) * 99 / 100];
+    return summary;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+typedef struct {
+    uint32_t count;
+    uint32_t errors;
+    uint64_t bytes;
+    uint32_t p50_us;
+    uint32_t p99_us;
+    uint32_t max_us;
+} LatencySummary_t;
+
+/*
+ * Keeps at most `capacity` latency samples using reservoir sampling, so long
+ * runs use constant memory while percentiles stay representative.
+ */
+class LatencyRecorder {
+   private:
+    std::vector<uint32_t> samples;
+    size_t capacity;
+    uint32_t count;
+    uint32_t errors;
+    uint64_t bytes;
+    uint32_t max_us;
+    uint32_t rng;
+
+   public:
+    void init(size_t capacity, uint32_t seed);
+    void record(uint32_t latency_us, size_t bytes, bool success);
+    void merge(LatencyRecorder& other);
+    LatencySummary_t summarize();
+};
@@ -0,0 +1,113 @@
+#include <esp_littlefs.h>
+#include <esp_log.h>
+#include <sys/stat.h>
+
+#include <cstdio>
+#include <cstring>
+
+#include "BenchTarget.h"
+
+#define MAX_PATH_LEN 64
+
+static const char* TAG = "bench";
+
+static const char* partitionLabels[BENCH_MAX_PARTITIONS] = {"bench0", "bench1"};
+static const char* partitionPaths[BENCH_MAX_PARTITIONS] = {"/bench0", "/bench1"};
+
+/*
+ * Linux target backend. The partitions live in the esp_partition flash
+ * emulation and are accessed through the LittleFS VFS, the same stack
+ * EspDataStorage uses underneath Arduino's fs::LittleFSFS.
+ */
+class VfsTarget : public BenchTarget {
+   private:
+    uint8_t partitions = 0;
+
+    void fullPath(uint8_t part, const char* path, char* dest) {
+        snprintf(dest, MAX_PATH_LEN, "%s%s", partitionPaths[part], path);
+    }
+
+    bool put(uint8_t part, const char* path, const char* data, const char* mode) {
+        char full[MAX_PATH_LEN];
+        fullPath(part, path, full);
+        FILE* f = fopen(full, mode);
+        if (f == NULL) return false;
+        size_t len = strlen(data);
+        bool res = (fwrite(data, 1, len, f) == len);
+        return (fclose(f) == 0) && res;
+    }
+
+   public:
+    bool setup(uint8_t partitions) override {
+        for (uint8_t i = 0; i < partitions; i++) {
+            esp_vfs_littlefs_conf_t conf = {};
+            conf.base_path = partitionPaths[i];
+            conf.partition_label = partitionLabels[i];
+            conf.format_if_mount_failed = true;
+
+            esp_err_t ret = esp_vfs_littlefs_register(&conf);
+            if (ret != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to mount partition %s (%s)", partitionLabels[i], esp_err_to_name(ret));
+                return false;
+            }
+            this->partitions = i + 1;
+        }
+        return true;
+    }
+
+    void teardown() override {
+        for (uint8_t i = 0; i < partitions; i++) {
+            esp_vfs_littlefs_unregister(partitionLabels[i]);
+        }
+        partitions = 0;
+    }
+
+    const char* name() override {
+        return "LittleFS baseline (emulated flash, no EspDataStorage)";
+    }
+
+    bool mkfile(uint8_t part, const char* path) override {
+        return put(part, path, "", "a");
+    }
+
+    bool rm(uint8_t part, const char* path) override {
+        char full[MAX_PATH_LEN];
+        fullPath(part, path, full);
+        return remove(full) == 0;
+    }
+
+    size_t fsize(uint8_t part, const char* path) override {
+        char full[MAX_PATH_LEN];
+        fullPath(part, path, full);
+        struct stat st;
+        if (stat(full, &st) != 0) return 0;
+        return st.st_size;
+    }
+
+    bool append(uint8_t part, const char* path, const char* data) override {
+        return put(part, path, data, "a");
+    }
+
+    bool write(uint8_t part, const char* path, const char* data) override {
+        return put(part, path, data, "w");
+    }
+
+    int read(uint8_t part, const char* path, char* dest, uint32_t len, uint32_t pos) override {
+        char full[MAX_PATH_LEN];
+        fullPath(part, path, full);
+        FILE* f = fopen(full, "r");
+        if (f == NULL) return -1;
+        if (fseek(f, pos, SEEK_SET) != 0) {
+            fclose(f);
+            return -1;
+        }
+        size_t n = fread(dest, 1, len, f);
+        fclose(f);
+        dest[n] = 0;
+        return n;
+    }
+};
+
+BenchTarget* createBenchTarget() {
+    return new VfsTarget();
+}
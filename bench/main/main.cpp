@@ -0,0 +1,42 @@
+#include <sdkconfig.h>
+
+#include <cstdlib>
+
+#include "BenchTarget.h"
+#include "Benchmark.h"
+#include "esp_log.h"
+
+static const char* TAG = "bench";
+
+extern "C" void app_main(void) {
+    BenchConfig_t config = {
+        .partitions = CONFIG_BENCH_PARTITIONS,
+        .writers = CONFIG_BENCH_WRITERS,
+        .appendSize = CONFIG_BENCH_APPEND_SIZE,
+        .writerDelay_ms = CONFIG_BENCH_WRITER_DELAY_MS,
+        .readers = CONFIG_BENCH_READERS,
+        .tailSize = CONFIG_BENCH_TAIL_SIZE,
+        .readBufferSize = CONFIG_BENCH_READ_BUFFER_SIZE,
+        .churners = CONFIG_BENCH_CHURN_TASKS,
+        .seqWriters = CONFIG_BENCH_SEQ_WRITERS,
+        .seqWriteSize = CONFIG_BENCH_SEQ_WRITE_SIZE,
+        .maxFileSize = CONFIG_BENCH_MAX_FILE_SIZE,
+        .duration_ms = CONFIG_BENCH_DURATION_S * 1000,
+        .samples = CONFIG_BENCH_SAMPLES,
+        .seed = CONFIG_BENCH_SEED,
+    };
+
+    BenchTarget* target = createBenchTarget();
+    Benchmark bench;
+    bool success = bench.run(target, config);
+    if (success) {
+        bench.report();
+    } else {
+        ESP_LOGE(TAG, "Benchmark failed");
+    }
+    delete target;
+
+#ifdef CONFIG_IDF_TARGET_LINUX
+    exit(success ? EXIT_SUCCESS : EXIT_FAILURE);
+#endif
+}
@@ -5,6 +5,7 @@
 #include <string.h>
 
 #include "EspDataStorage.h"
+#include "KeyValueStore.h"
 #include "esp_log.h"
 
 #define STORAGE_DEVICE_A_ID 1
@@ -46,11 +47,40 @@ static void writeTask(void* arg) {
     }
 }
 
+static void keyValueDemo(Partition_t* fs) {
+    KeyValueConfig_t config = KEY_VALUE_CONFIG_DEFAULT();
+    KeyValueStore kv;
+    if (!kv.init(&storage, fs, "/kv", config)) return;
+
+    // Overwrite a few keys many times so most of the log turns into dead records
+    char key[16];
+    char value[32];
+    for (uint32_t i = 0; i < 200; i++) {
+        sprintf(key, "sensor%u", i % 10);
+        sprintf(value, "reading %u", i);
+        kv.put(key, value, strlen(value) + 1);
+    }
+    kv.del("sensor0");
+    kv.compact();
+
+    KeyValueStats_t stats = kv.getStats();
+    ESP_LOGI(TAG, "kv keys: %u, live: %u, log: %u, compactions: %u", stats.count, stats.liveBytes, stats.logBytes, stats.compactions);
+    kv.done();
+
+    // Reopen, the index is loaded from the checkpoint written by done()
+    if (!kv.init(&storage, fs, "/kv", config)) return;
+    if (kv.get("sensor9", value, sizeof(value)) == STORAGE_OK) ESP_LOGI(TAG, "kv sensor9: %s", value);
+    ESP_LOGI(TAG, "kv sensor0: %s", kv.exists("sensor0") ? "found" : "deleted");
+    kv.done();
+}
+
 extern "C" void app_main(void) {
     storage.init();
 
     // Initialize storage partition in external flash
     storage.mkdev(STORAGE_DEVICE_A_ID, STORAGE_DEVICE_TYPE_FLASH);
+    StorageCacheConfig_t cacheConfig = STORAGE_CACHE_CONFIG_DEFAULT();
+    storage.mkcache(STORAGE_DEVICE_A_ID, cacheConfig);
     storage.mkpartition(STORAGE_DEVICE_A_ID, "exFS", 0x100000);
     exFS = storage.mount("exFS", "/exFS", true);
 
@@ -85,6 +115,13 @@ extern "C" void app_main(void) {
     ESP_LOGI(TAG, "File content external:\n%s", buffer);
     ESP_LOGI(TAG, "File content internal:\n%s", bufferIn);
 
+    StorageCacheStats_t cacheStats;
+    if (storage.cachestat(STORAGE_DEVICE_A_ID, &cacheStats)) {
+        ESP_LOGI(TAG, "exFS cache hits: %u, misses: %u, evictions: %u", cacheStats.hits, cacheStats.misses, cacheStats.evictions);
+    }
+
+    keyValueDemo(inFS);
+
     storage.rm(exFS, "/data.txt");
     storage.rm(inFS, "/data.txt");
     storage.unmount(exFS);
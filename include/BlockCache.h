@@ -0,0 +1,88 @@
+#pragma once
+
+#include <esp_err.h>
+
+#include <cstddef>
+#include <cstdint>
+
+typedef enum {
+    STORAGE_CACHE_POLICY_LRU = 0,
+    STORAGE_CACHE_POLICY_CLOCK,
+} StorageCachePolicy_t;
+
+typedef struct {
+    uint32_t blockSize;           // Bytes per cache line, power of two
+    uint32_t blockCount;          // Number of cache lines
+    StorageCachePolicy_t policy;  // Eviction policy
+    uint8_t readAhead;            // Lines kept loaded ahead of a sequential read
+    bool usePsram;                // Allocate cache lines in PSRAM
+} StorageCacheConfig_t;
+
+#define STORAGE_CACHE_CONFIG_DEFAULT() {      \
+    .blockSize = 512,                         \
+    .blockCount = 32,                         \
+    .policy = STORAGE_CACHE_POLICY_LRU,       \
+    .readAhead = 1,                           \
+    .usePsram = false,                        \
+}
+
+typedef struct {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t evictions;
+    uint32_t prefetches;
+    uint32_t programs;
+} StorageCacheStats_t;
+
+typedef esp_err_t (*BlockCacheRead_t)(void* ctx, uint32_t address, void* dest, uint32_t len);
+typedef esp_err_t (*BlockCacheProgram_t)(void* ctx, uint32_t address, const void* src, uint32_t len);
+
+/*
+ * Read cache for a NOR flash backend. Not thread-safe, callers must serialize
+ * access (SPIFlash does this through the flash chip lock).
+ *
+ * Programs are written through, a failed program invalidates the lines it
+ * touched and is reported to the caller.
+ */
+class BlockCache {
+   private:
+    typedef struct {
+        uint32_t block;
+        uint32_t stamp;
+        bool valid;
+        bool referenced;
+    } Line_t;
+
+    StorageCacheConfig_t config;
+    uint32_t capacity;
+    uint8_t blockShift;
+
+    uint8_t* data;
+    Line_t* lines;
+    uint32_t tick;
+    uint32_t hand;
+    uint32_t lastBlock;
+
+    BlockCacheRead_t backendRead;
+    BlockCacheProgram_t backendProgram;
+    void* ctx;
+
+    StorageCacheStats_t stats;
+
+    int find(uint32_t block);
+    int victim();
+    int fill(uint32_t block, esp_err_t* err);
+    void touch(int line);
+
+   public:
+    bool init(const StorageCacheConfig_t& config, uint32_t capacity, BlockCacheRead_t read, BlockCacheProgram_t program, void* ctx);
+    void done();
+
+    esp_err_t read(uint32_t address, void* dest, uint32_t len);
+    esp_err_t program(uint32_t address, const void* src, uint32_t len);
+    void erase(uint32_t address, uint32_t len);
+    void invalidate(uint32_t address, uint32_t len);
+
+    StorageCacheStats_t getStats();
+    void resetStats();
+};
@@ -17,13 +17,51 @@ typedef enum {
     STORAGE_READ_OUT_OF_RANGE,
     STORAGE_READ_IS_DIRECTORY,
     STORAGE_READ_MAX_BUFFER,
+    STORAGE_NOT_FOUND,
 } StorageErr_t;
 
+/*
+ * Partition archive layout, all fields little-endian:
+ *
+ *   StorageArchiveHeader_t
+ *   { StorageArchiveEntry_t, path[pathLen], data[size], uint32_t crc32(data) } ...
+ *   StorageArchiveEntry_t with pathLen == 0 (size holds the number of entries)
+ */
+#define STORAGE_ARCHIVE_MAGIC 0x41534445  // "EDSA"
+#define STORAGE_ARCHIVE_VERSION 1
+#define STORAGE_ARCHIVE_FLAG_INCREMENTAL (1 << 0)
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t flags;
+    int64_t since;
+} StorageArchiveHeader_t;
+
+typedef struct __attribute__((packed)) {
+    uint16_t pathLen;
+    uint32_t size;
+    int64_t mtime;
+} StorageArchiveEntry_t;
+
+// Receives the next archive chunk, every chunk but the last one is 512 bytes. Return false to abort the export.
+typedef bool (*StorageSink_t)(const uint8_t* data, size_t len, void* arg);
+// Fills up to len bytes of archive, returns the number of bytes provided (0 on end of stream).
+typedef size_t (*StorageSource_t)(uint8_t* data, size_t len, void* arg);
+
+// Export pipeline state shared between the caller and the flash reader task
+typedef struct StorageArchiveStream StorageArchiveStream_t;
+
 class EspDataStorage {
    private:
     std::unordered_map<uint8_t, std::shared_ptr<StorageDevice>> devices;
     uint32_t _waitTimeout_ms;
 
+    bool exportFile(Partition_t* fs, const char* path, StorageArchiveStream_t* stream);
+    bool exportTree(Partition_t* fs, const char* dirname, StorageArchiveStream_t* stream);
+    static void exportTask(void* arg);
+    bool importFile(Partition_t* fs, const char* path, uint32_t size, StorageSource_t source, void* arg, uint8_t* chunk);
+
    public:
     bool init(uint32_t waitTimeout_ms = 500);
     void done();
@@ -31,6 +69,8 @@ class EspDataStorage {
 
     bool mkdev(uint8_t id, StorageDeviceType_t type);
     bool rmdev(uint8_t id);
+    bool mkcache(uint8_t id, const StorageCacheConfig_t& config);
+    bool cachestat(uint8_t id, StorageCacheStats_t* stats, bool reset = false);
 
     bool mkpartition(uint8_t partitionID, const char* label, size_t size);
     Partition_t* mount(const char* partitionLabel, const char* basePath, bool formatOnFail = false);
@@ -43,8 +83,16 @@ class EspDataStorage {
 
     bool mkfile(Partition_t* fs, const char* path);
     bool rm(Partition_t* fs, const char* path);
+    bool mv(Partition_t* fs, const char* from, const char* to);
     size_t fsize(Partition_t* fs, const char* path);
     StorageErr_t read(Partition_t* fs, const char* path, char* dest, uint32_t bufferLen, char terminator = 0, uint32_t pos = 0);
     bool append(Partition_t* fs, const char* path, const char* data);
     bool write(Partition_t* fs, const char* path, const char* data);
+
+    StorageErr_t read(Partition_t* fs, const char* path, uint8_t* dest, size_t len, uint32_t pos, size_t* readLen = NULL);
+    bool append(Partition_t* fs, const char* path, const uint8_t* data, size_t len);
+    bool write(Partition_t* fs, const char* path, const uint8_t* data, size_t len);
+
+    bool exportdir(Partition_t* fs, const char* dirname, StorageSink_t sink, void* arg, time_t since = 0, time_t* marker = NULL);
+    bool importdir(Partition_t* fs, StorageSource_t source, void* arg);
 };
\ No newline at end of file
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#include "EspDataStorage.h"
+
+#define KV_MAX_KEY_LEN 64
+#define KV_MAX_VALUE_LEN 1024
+#define KV_MAX_DIRNAME_LEN 32
+#define KV_MAX_PATH_LEN 48
+
+typedef struct {
+    uint32_t capacity;            // Initial index slots, rounded up to a power of two
+    uint8_t compactThreshold;     // Dead space percentage that starts a compaction
+    uint32_t compactMinSize;      // Logs smaller than this are never compacted
+    uint16_t compactBatch;        // Records moved per compaction step
+    uint32_t checkpointInterval;  // Updates between index checkpoints, 0 to only checkpoint after compaction
+    UBaseType_t taskPriority;
+    uint32_t taskStackSize;
+} KeyValueConfig_t;
+
+#define KEY_VALUE_CONFIG_DEFAULT() {  \
+    .capacity = 64,                   \
+    .compactThreshold = 50,           \
+    .compactMinSize = 4096,           \
+    .compactBatch = 16,               \
+    .checkpointInterval = 64,         \
+    .taskPriority = 1,                \
+    .taskStackSize = 1024 * 4,        \
+}
+
+typedef struct {
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t liveBytes;
+    uint32_t logBytes;
+    uint32_t compactions;
+    bool compacting;
+} KeyValueStats_t;
+
+/*
+ * Key-value store on an append-only log. Every key is indexed in RAM by its
+ * hash, so a get is one index probe plus one read and a put is one append.
+ *
+ * Logs are named by generation inside `dirname`. Compaction copies the live
+ * records of generation G into G+1 a batch at a time from a background task,
+ * while new updates already go to G+1. The index is checkpointed to disk, on
+ * startup only the log tail written after the checkpoint is replayed. Without
+ * a usable checkpoint the newest generation found in `dirname` is replayed.
+ *
+ * The active logs stay open for the lifetime of the store and are accessed
+ * through the partition directly, outside the EspDataStorage lock. Each record
+ * is synced on its own; replay stops at the first invalid record, so after a
+ * failed or torn append no further record is written until a checkpoint past
+ * the invalid bytes exists. Failed background steps are retried with backoff.
+ *
+ * Keys are identified by 48 bits of their FNV-1a hash; gets still compare the
+ * stored key and report STORAGE_FAIL on a collision. Call done() before the
+ * partition is unmounted.
+ */
+class KeyValueStore {
+   private:
+    typedef struct {
+        uint32_t hash;
+        uint16_t tag;
+        uint16_t size;  // 0 marks an empty slot
+        uint32_t loc;
+    } Slot_t;
+
+    EspDataStorage* storage;
+    Partition_t* fs;
+    char dirname[KV_MAX_DIRNAME_LEN];
+    KeyValueConfig_t config;
+
+    Slot_t* slots;
+    uint32_t capacity;
+    uint32_t count;
+    uint32_t liveBytes;
+    uint8_t* scratch;
+
+    uint32_t gen;
+    uint32_t logSize;
+    uint32_t updates;
+    uint32_t compactions;
+
+    bool compacting;
+    uint32_t nextSize;
+    uint32_t cursor;
+    uint32_t pendingMoves;
+
+    File logFile;
+    File nextFile;
+    bool unsafeTail;     // A log ends in bytes replay would stop at
+    bool checkpointDue;  // A finished compaction still has to be checkpointed
+
+    SemaphoreHandle_t mutex;
+    SemaphoreHandle_t stopped;
+    TaskHandle_t task;
+    volatile bool stopping;
+
+    void logPath(uint32_t generation, char* dest);
+    void indexPath(char* dest, bool temp);
+
+    int find(uint32_t hash, uint16_t tag);
+    bool insert(const Slot_t& slot);
+    void erase(int index);
+    bool grow();
+
+    bool openLog(uint32_t generation, File* file);
+    bool reopenLog(bool next);
+    bool readLog(File& file, uint32_t pos, uint8_t* dest, size_t len);
+    bool appendLog(bool next, const uint8_t* data, size_t len);
+    bool scanGenerations(uint32_t* generation);
+
+    bool apply(const uint8_t* record, uint32_t loc);
+    bool replay(File& file, uint32_t from, bool next, bool* clean);
+    bool loadCheckpoint(bool* resume);
+    bool writeCheckpoint();
+
+    bool prepareAppend();
+    bool appendRecord(uint16_t size, uint32_t* loc);
+    void afterUpdate();
+
+    void startCompaction();
+    bool compactStep();
+    bool finishCompaction();
+    static void compactTask(void* arg);
+
+   public:
+    bool init(EspDataStorage* storage, Partition_t* fs, const char* dirname, const KeyValueConfig_t& config);
+    void done();
+
+    StorageErr_t get(const char* key, void* value, size_t len, size_t* valueLen = NULL);
+    bool put(const char* key, const void* value, size_t len);
+    bool del(const char* key);
+    bool exists(const char* key);
+
+    bool checkpoint();
+    bool compact();
+    KeyValueStats_t getStats();
+};
@@ -4,6 +4,7 @@
 #include <esp_flash.h>
 #include <esp_flash_spi_init.h>
 #include <esp_partition.h>
+#include <spi_flash_chip_driver.h>
 
 #include "StorageDevice.h"
 #include "esp_littlefs.h"
@@ -17,11 +18,29 @@ class SPIFlash : public StorageDevice {
 
     const esp_partition_t* partition;
 
+    const spi_flash_chip_t* chipDriver;
+    spi_flash_chip_t cachedDriver;
+
     esp_err_t initSPIbus();
     esp_err_t addFlashDevice();
 
+    void lockChip();
+    void unlockChip();
+
+    static SPIFlash* fromChip(esp_flash_t* chip);
+    static esp_err_t backendRead(void* ctx, uint32_t address, void* dest, uint32_t len);
+    static esp_err_t backendProgram(void* ctx, uint32_t address, const void* src, uint32_t len);
+    static esp_err_t cachedRead(esp_flash_t* chip, void* buffer, uint32_t address, uint32_t length);
+    static esp_err_t cachedWrite(esp_flash_t* chip, const void* buffer, uint32_t address, uint32_t length);
+    static esp_err_t cachedEraseChip(esp_flash_t* chip);
+    static esp_err_t cachedEraseSector(esp_flash_t* chip, uint32_t address);
+    static esp_err_t cachedEraseBlock(esp_flash_t* chip, uint32_t address);
+
    public:
     bool install() override;
     bool uninstall() override;
     bool registerPartition(const char* label, size_t size) override;
+
+    bool enableCache(const StorageCacheConfig_t& config) override;
+    bool getCacheStats(StorageCacheStats_t* stats, bool reset) override;
 };
\ No newline at end of file
@@ -2,6 +2,9 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <memory>
+
+#include "BlockCache.h"
 
 typedef enum {
     STORAGE_DEVICE_ONLINE = 0,
@@ -24,12 +27,16 @@ typedef struct {
 class StorageDevice {
    protected:
     StorageDeviceInfo_t info;
+    std::unique_ptr<BlockCache> cache;
 
    public:
     virtual bool install() = 0;
     virtual bool uninstall() = 0;
     virtual bool registerPartition(const char* label, size_t size) = 0;
 
+    virtual bool enableCache(const StorageCacheConfig_t& config);
+    virtual bool getCacheStats(StorageCacheStats_t* stats, bool reset);
+
     void printInfo();
     StorageDeviceInfo_t getInfo();
 };
\ No newline at end of file